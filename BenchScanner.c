@@ -0,0 +1,321 @@
+/*
+ * File: BenchScanner.c
+ * Description: Benchmarks for the scanner character device.
+ * Author(s): Miguel Carrasco Belmar
+ * Date: 12/09/2025
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "scanner.h"
+#include "scanner_engine.h"
+
+#define ERR(s) err(s,__FILE__,__LINE__)
+
+static void err(char *s, char *file, int line) {
+  fprintf(stderr,"%s:%d: %s\n",file,line,s);
+  exit(1);
+}
+
+static const char *device_path = "/dev/scanner"; // device under test
+
+// This function returns the current time in seconds
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// This function fills buf with words of 1-12 letters, each followed by one of the given separators
+static void make_text(char *buf, size_t len, const char *seps) {
+  size_t count = strlen(seps);
+  unsigned int seed = 552;
+  size_t i = 0;
+  while (i < len) {
+    int word = 1 + rand_r(&seed) % 12;
+    while (word-- > 0 && i < len)
+      buf[i++] = 'a' + rand_r(&seed) % 26;
+    if (i < len)
+      buf[i++] = seps[rand_r(&seed) % count];
+  }
+}
+
+// Token benchmarks: the plain write()/read() protocol, to compare devices (module vs CUSE daemon)
+
+// This function reads every token of the written data, returning the token count
+static long read_all_tokens(int fd, char *buf, size_t size) {
+  long tokens = 0;
+  while (1) {
+    ssize_t n = read(fd, buf, size);
+    if (n == 0)
+      tokens++; // end of token
+    else if (n < 0)
+      return tokens; // end of data (-1)
+  }
+}
+
+// This function measures per-token latency on small documents and throughput on one large one
+static void bench_tokens(size_t len) {
+  static const char doc[] = "GET /index.html HTTP/1.1\nHost: example.com\nAccept: */*\n"; // 7 tokens
+  const int docs = 100000;
+  char buf[64 << 10];
+  long tokens = 0;
+
+  int fd = open(device_path, O_RDWR);
+  if (fd < 0)
+    ERR("open() failed");
+
+  printf("Tokens: %d small documents, then one %zu MB document\n", docs, len >> 20);
+  double start = now();
+  for (int i = 0; i < docs; i++) {
+    if (write(fd, doc, sizeof(doc) - 1) < 0)
+      ERR("write() failed");
+    tokens += read_all_tokens(fd, buf, sizeof(buf));
+  }
+  double secs = now() - start;
+  printf("  small documents: %8.0f ns/token %8.0f ns/document\n", secs / tokens * 1e9, secs / docs * 1e9);
+
+  char *text = malloc(len);
+  if (!text)
+    ERR("malloc() failed");
+  make_text(text, len, " \t\n:");
+  start = now();
+  if (write(fd, text, len) < 0)
+    ERR("write() failed (raise max_bytes for large documents)");
+  tokens = read_all_tokens(fd, buf, sizeof(buf));
+  secs = now() - start;
+  printf("  large document:  %8.1f MB/s %10.0f tokens/s\n", len / secs / 1e6, tokens / secs);
+  free(text);
+  close(fd);
+}
+
+// Ring benchmark: a producer thread streams text into a ring that the main thread tokenizes
+
+typedef struct {
+  int fd;          // producer end of the ring
+  const char *text; // bytes to stream
+  size_t len;      // number of bytes to stream
+  size_t chunk;    // bytes per write()
+} Producer;
+
+// This function writes the whole text into the ring, then closes the producer
+static void *produce(void *arg) {
+  Producer *p = arg;
+  size_t sent = 0;
+  while (sent < p->len) {
+    size_t n = (p->len - sent < p->chunk) ? p->len - sent : p->chunk;
+    ssize_t len = write(p->fd, p->text + sent, n);
+    if (len < 0)
+      ERR("write() failed on ring producer");
+    sent += len;
+  }
+  close(p->fd); // lets the consumer see the end of data
+  return NULL;
+}
+
+// This function streams len bytes through one ring and reports throughput.
+// It returns 0 if the device has no rings.
+static int bench_ring_once(const char *text, size_t len, size_t ring_size, unsigned int flags) {
+  int producer = open(device_path, O_RDWR);
+  int consumer = open(device_path, O_RDWR);
+  if (producer < 0 || consumer < 0)
+    ERR("open() failed");
+
+  struct scanner_ring ring = { ring_size, flags, 0 };
+  if (ioctl(producer, SCANNER_IOC_RING, &ring) < 0) {
+    if (errno == EOPNOTSUPP) { // only the kernel module links fds
+      printf("  rings are not supported by this device\n");
+      close(producer);
+      close(consumer);
+      return 0;
+    }
+    ERR("ioctl() failed to create ring");
+  }
+  if (ioctl(consumer, SCANNER_IOC_RING_ATTACH, producer) < 0)
+    ERR("ioctl() failed to attach ring");
+
+  Producer p = { producer, text, len, 64 << 10 };
+  pthread_t thread;
+  char buf[64 << 10];
+  long tokens = 0;
+  double start = now();
+
+  if (pthread_create(&thread, NULL, produce, &p))
+    ERR("pthread_create() failed");
+  while (1) {
+    ssize_t n = read(consumer, buf, sizeof(buf));
+    if (n == 0)
+      tokens++; // end of token
+    else if (n < 0)
+      break; // end of data (-1)
+  }
+  pthread_join(thread, NULL);
+  double secs = now() - start;
+
+  printf("  %-9s ring %7zu B: %8.1f MB/s %10.0f tokens/s\n",
+         (flags & SCANNER_RING_MUTEX) ? "mutex" : "lock-free", ring_size,
+         len / secs / 1e6, tokens / secs);
+  close(consumer);
+  return 1;
+}
+
+// This function compares lock-free and mutex rings over several ring sizes
+static void bench_ring(size_t len) {
+  static const size_t sizes[] = { 4 << 10, 64 << 10, 1 << 20 };
+  char *text = malloc(len);
+  if (!text)
+    ERR("malloc() failed");
+  make_text(text, len, " \t\n:");
+
+  printf("Ring: %zu MB streamed from a producer thread to a consumer thread\n", len >> 20);
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    if (!bench_ring_once(text, len, sizes[i], 0))
+      break;
+    bench_ring_once(text, len, sizes[i], SCANNER_RING_MUTEX);
+  }
+  free(text);
+}
+
+// Engine benchmark: each specialized token finder against the generic loop, in user space
+
+// This function scans len bytes with one token finder, pass after pass for a quarter second.
+// It returns MB/s for the fastest pass (the least disturbed one) and sets *tokens to the tokens found.
+static double scan_rate(const ScanSeps *seps, ScanFind find, const char *text, size_t len, long *tokens) {
+  double start = now(), best = 0;
+  do {
+    size_t pos = 0, token_start;
+    long n = 0;
+    double pass_start = now(), secs;
+    while (find(seps, text, &pos, len, &token_start))
+      n++;
+    secs = now() - pass_start;
+    if (best == 0 || secs < best)
+      best = secs;
+    *tokens = n;
+  } while (now() - start < 0.25);
+  return len / best / 1e6;
+}
+
+// This function compares the finder picked for each common separator set with the generic
+// byte-table loop and with the decoding loop every set used before the specializations
+static void bench_engine(size_t len) {
+  static const struct {
+    const char *loop;       // finder picked for this set
+    const char *separators; // separator set
+    const char *text_seps;  // separators placed in the text
+  } sets[] = {
+    { "none",    "",        " \t\n:" },
+    { "single",  ",",       "," },
+    { "table",   "-,;.",    "-,;." },
+  };
+  char *text = malloc(len);
+  if (!text)
+    ERR("malloc() failed");
+
+  printf("Engine: %zu MB scanned in user space, MB/s\n", len >> 20);
+  printf("  %-8s %12s %12s %12s %8s\n", "set", "specialized", "table", "decoding", "tokens");
+  for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+    ScanSeps seps = { .utf8 = 0 };
+    long tokens, table_tokens, old_tokens;
+    make_text(text, len, sets[i].text_seps);
+    scan_fill_separators(&seps, sets[i].separators, strlen(sets[i].separators), NULL);
+
+    double fast = scan_rate(&seps, seps.find, text, len, &tokens);
+    double table = scan_rate(&seps, scan_find_table, text, len, &table_tokens);
+    ScanSeps decoding = seps;
+    decoding.utf8 = 1; // the decoding loop only runs in UTF-8 mode
+    double old = scan_rate(&decoding, scan_find_utf8, text, len, &old_tokens);
+    if (tokens != table_tokens || tokens != old_tokens)
+      ERR("token finders disagree");
+    printf("  %-8s %12.4g %12.4g %12.4g %8ld\n", sets[i].loop, fast, table, old, tokens);
+  }
+  free(text);
+}
+
+// Pages benchmark: one large document scanned from buffers allocated under each SCANNER_PAGES_* mode
+
+// This function writes len bytes under each page mode and reports write and scan throughput.
+// The text has spaces, tabs and colons but only one newline every 64 KB, and tokens are split on
+// newlines only, so each token is one long memchr() over the buffer and the sequential scan,
+// not per-token work, dominates.
+static void bench_pages(size_t len) {
+  static const struct {
+    const char *name;   // mode description
+    unsigned int flags; // SCANNER_PAGES_* flags
+  } modes[] = {
+    { "base pages, any node", 0 },
+    { "base pages, local node", SCANNER_PAGES_LOCAL },
+    { "huge pages, any node", SCANNER_PAGES_HUGE },
+    { "huge pages, local node", SCANNER_PAGES_LOCAL | SCANNER_PAGES_HUGE },
+  };
+  const size_t recs_size = 1 << 20; // token records per read()
+  const size_t line_size = 1 << 16; // bytes per token
+  char *text = malloc(len);
+  struct scanner_token *recs = malloc(recs_size);
+  if (!text || !recs)
+    ERR("malloc() failed");
+  make_text(text, len, " \t:");
+  for (size_t at = line_size - 1; at < len; at += line_size)
+    text[at] = '\n';
+
+  printf("Pages: one %zu MB document, tokens split on newlines every %zu KB\n", len >> 20, line_size >> 10);
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+    int fd = open(device_path, O_RDWR);
+    if (fd < 0)
+      ERR("open() failed");
+    if (ioctl(fd, SCANNER_IOC_PAGES, modes[i].flags) < 0)
+      ERR("ioctl() failed to set buffer pages");
+    if (ioctl(fd, SCANNER_IOC_CONFIG, 0) < 0 || write(fd, "\n", 1) < 0)
+      ERR("failed to set separators");
+    if (ioctl(fd, SCANNER_IOC_META, 1) < 0)
+      ERR("ioctl() failed to set metadata mode");
+
+    double start = now();
+    if (write(fd, text, len) < 0)
+      ERR("write() failed (raise max_bytes to at least the document size)");
+    double write_secs = now() - start;
+
+    long tokens = 0;
+    ssize_t n;
+    start = now();
+    while ((n = read(fd, recs, recs_size)) > 0)
+      tokens += n / sizeof(*recs);
+    double scan_secs = now() - start;
+
+    printf("  %-24s write %8.1f MB/s  scan %8.1f MB/s %10ld tokens\n", modes[i].name,
+           len / write_secs / 1e6, len / scan_secs / 1e6, tokens);
+    close(fd);
+  }
+  free(recs);
+  free(text);
+}
+
+int main(int argc, char *argv[]) {
+  const char *which = (argc > 1) ? argv[1] : "all";
+  size_t mb = (argc > 2) ? strtoul(argv[2], NULL, 0) : (!strcmp(which, "pages") ? 1024 : 32);
+  if (argc > 3)
+    device_path = argv[3];
+  if (mb == 0) {
+    fprintf(stderr, "usage: %s [all|tokens|ring|engine|pages] [megabytes] [device]\n", argv[0]);
+    return 1;
+  }
+
+  printf("=== Scanner Device Benchmark (%s) ===\n", device_path);
+  if (!strcmp(which, "all") || !strcmp(which, "tokens"))
+    bench_tokens(mb << 20);
+  if (!strcmp(which, "all") || !strcmp(which, "ring"))
+    bench_ring(mb << 20);
+  if (!strcmp(which, "all") || !strcmp(which, "engine"))
+    bench_engine(mb << 20);
+  if (!strcmp(which, "all") || !strcmp(which, "pages"))
+    bench_pages(mb << 20);
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * File: BenchUring.c
+ * Description: Compares write-then-tokenize jobs through plain syscalls and through io_uring.
+ * Author(s): Miguel Carrasco Belmar
+ * Date: 12/09/2025
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <liburing.h>
+
+#include "scanner.h"
+
+#define ERR(s) err(s,__FILE__,__LINE__)
+
+static void err(char *s, char *file, int line) {
+  fprintf(stderr,"%s:%d: %s\n",file,line,s);
+  exit(1);
+}
+
+#define MAX_DEPTH 256
+
+static const char *device_path = "/dev/scanner"; // device under test
+static const char doc[] = "GET /index.html HTTP/1.1\nHost: example.com\nAccept: */*\n"; // 7 tokens
+static struct scanner_token recs[MAX_DEPTH][16]; // token records read back, one slot per fd
+
+// This function returns the current time in seconds
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// This function opens depth sessions in metadata mode, so one read() returns all tokens of a job
+static void open_sessions(int *fds, int depth) {
+  for (int i = 0; i < depth; i++) {
+    fds[i] = open(device_path, O_RDWR);
+    if (fds[i] < 0)
+      ERR("open() failed");
+    if (ioctl(fds[i], SCANNER_IOC_META, 1) < 0)
+      ERR("ioctl() failed to set metadata mode");
+  }
+}
+
+// This function runs jobs write-then-tokenize jobs round-robin over depth fds,
+// two syscalls per job, and returns the elapsed time
+static double run_sync(int *fds, int depth, long jobs) {
+  double start = now();
+  for (long j = 0; j < jobs; j++) {
+    int i = j % depth;
+    if (write(fds[i], doc, sizeof(doc) - 1) < 0)
+      ERR("write() failed");
+    if (read(fds[i], recs[i], sizeof(recs[i])) != 7 * sizeof(struct scanner_token))
+      ERR("read() returned the wrong number of tokens");
+  }
+  return now() - start;
+}
+
+// This function runs the same jobs through io_uring, depth jobs per io_uring_enter():
+// each job is a write linked to the read of its tokens, so the read only starts once the write is done.
+// It returns the elapsed time.
+static double run_uring(struct io_uring *ring, int *fds, int depth, long jobs) {
+  double start = now();
+  for (long done = 0; done < jobs; ) {
+    int batch = (jobs - done < depth) ? jobs - done : depth;
+    for (int i = 0; i < batch; i++) {
+      struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+      io_uring_prep_write(sqe, fds[i], doc, sizeof(doc) - 1, 0);
+      sqe->flags |= IOSQE_IO_LINK;
+      io_uring_sqe_set_data64(sqe, 0);
+      sqe = io_uring_get_sqe(ring);
+      io_uring_prep_read(sqe, fds[i], recs[i], sizeof(recs[i]), 0);
+      io_uring_sqe_set_data64(sqe, 1);
+    }
+    // submit the batch and wait for all of it in one system call
+    if (io_uring_submit_and_wait(ring, 2 * batch) < 0)
+      ERR("io_uring_submit_and_wait() failed");
+
+    struct io_uring_cqe *cqe;
+    unsigned head, seen = 0;
+    io_uring_for_each_cqe(ring, head, cqe) {
+      if (cqe->res < 0)
+        ERR("io_uring request failed");
+      if (cqe->user_data == 1 && cqe->res != 7 * sizeof(struct scanner_token))
+        ERR("io_uring read returned the wrong number of tokens");
+      seen++;
+    }
+    io_uring_cq_advance(ring, seen);
+    done += batch;
+  }
+  return now() - start;
+}
+
+int main(int argc, char *argv[]) {
+  long jobs = (argc > 1) ? strtol(argv[1], NULL, 0) : 200000;
+  if (argc > 2)
+    device_path = argv[2];
+  if (jobs <= 0) {
+    fprintf(stderr, "usage: %s [jobs] [device]\n", argv[0]);
+    return 1;
+  }
+
+  struct io_uring ring;
+  int err = io_uring_queue_init(2 * MAX_DEPTH, &ring, 0);
+  if (err < 0) {
+    fprintf(stderr, "io_uring_queue_init() failed: %s\n", strerror(-err));
+    return 1;
+  }
+
+  printf("=== Scanner io_uring Benchmark (%s) ===\n", device_path);
+  printf("%ld write-then-tokenize jobs of 7 tokens each\n", jobs);
+  printf("%6s %14s %14s %8s %16s\n", "depth", "sync jobs/s", "uring jobs/s", "speedup", "uring enters/job");
+  for (int depth = 1; depth <= MAX_DEPTH; depth *= 2) {
+    int fds[MAX_DEPTH];
+    open_sessions(fds, depth);
+    double sync_secs = run_sync(fds, depth, jobs);
+    double uring_secs = run_uring(&ring, fds, depth, jobs);
+    printf("%6d %14.0f %14.0f %7.2fx %16.3f\n", depth, jobs / sync_secs, jobs / uring_secs,
+           sync_secs / uring_secs, 1.0 / depth);
+    for (int i = 0; i < depth; i++)
+      close(fds[i]);
+  }
+  io_uring_queue_exit(&ring);
+  return 0;
+}
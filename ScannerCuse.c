@@ -0,0 +1,609 @@
+/*
+ * File: ScannerCuse.c
+ * Description: User-space scanner device built on CUSE, for hosts that cannot load scanner.ko.
+ *              It serves the /dev/scanner protocol with the module's scan engine (scanner_engine.h).
+ * Author(s): Miguel Carrasco Belmar
+ * Date: 12/09/2025
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <cuse_lowlevel.h>
+#include <fuse_opt.h>
+
+#include "scanner.h"
+#include "scanner_engine.h"
+
+// This struct holds the daemon's command-line options
+typedef struct {
+  char *name;              // device name under /dev
+  unsigned long max_bytes; // largest write() any session may buffer, 0= no limit
+  unsigned int buffer_pages; // SCANNER_PAGES_* flags new sessions start with
+} Options;
+
+static Options options = { NULL, 64UL << 20, SCANNER_PAGES_LOCAL | SCANNER_PAGES_HUGE };
+
+static const struct fuse_opt option_spec[] = {
+  { "--name=%s", offsetof(Options, name), 1 },
+  { "--max-bytes=%lu", offsetof(Options, max_bytes), 1 },
+  { "--buffer-pages=%u", offsetof(Options, buffer_pages), 1 },
+  FUSE_OPT_END
+};
+
+// This struct holds per-open() data, like File in scanner.c
+typedef struct {
+  pthread_mutex_t lock; // requests on one fd may arrive on several daemon threads
+  char *data;        // data to scan
+  char *pending;     // bytes of the write() being assembled, NULL= none
+  size_t pending_len; // bytes of it received so far
+  size_t pending_size; // bytes allocated for it
+  size_t data_len;   // length of data
+  ScanDoc *docs;     // documents in data (just &whole outside batch mode)
+  size_t doc_count;  // number of documents
+  ScanDoc whole;     // the single document of a plain write
+  size_t pos;        // current scanning position
+  size_t doc;        // index of the document being scanned
+  size_t token_start; // start index of the current token
+  size_t token_end;   // end index of the current token
+  size_t token_read_pos; // read position within the current token
+  char *separators;  // separator characters
+  size_t sep_count;  // number of separator characters
+  ScanSeps seps;     // lookup tables built from separators, and the UTF-8 mode flag
+  int config_mode;   // configuration mode flag, 1= next write sets separators
+  int meta_mode;     // metadata mode flag, 1= read returns scanner_token records
+  int batch_mode;    // batch mode flag, 1= writes carry length-prefixed documents
+  unsigned char *xlat; // 256-byte table applied to token bytes on read, NULL= identity
+  size_t max_bytes;  // largest write() this session accepts, 0= only the daemon limit
+  unsigned int pages; // SCANNER_PAGES_* flags for buffers of later writes
+} Session;
+
+#define HUGE_PAGE_SIZE (2UL << 20) // transparent huge page size on x86-64 and arm64 (4K base pages)
+
+// The kernel passes one write() to the daemon in pieces at increasing offsets from 0, each of
+// 32 pages less the offset of the caller's buffer into its first page, and only the last shorter.
+// A piece of 31 pages or less therefore always ends its write().
+#define LAST_PIECE_MAX (31 * 4096)
+
+// This function returns the session of an open file
+static Session *session(struct fuse_file_info *fi) {
+  return (Session *)(uintptr_t)fi->fh;
+}
+
+// This function sends a driver-style result: a byte count, or a negative errno.
+// The driver's -1 (no more tokens) reaches callers as EPERM, so it does here too.
+static void reply_write(fuse_req_t req, long result) {
+  if (result < 0)
+    fuse_reply_err(req, -result);
+  else
+    fuse_reply_write(req, result);
+}
+
+// This function builds the separator lookup tables for count separator bytes
+static int build_separators(Session *s, const char *separators, size_t count) {
+  long wide_count = scan_count_wide(s->seps.utf8, separators, count);
+  __u32 *wide = NULL;
+
+  if (wide_count < 0)
+    return wide_count;
+  if (wide_count) {
+    wide = malloc(wide_count * sizeof(*wide));
+    if (!wide)
+      return -ENOMEM;
+  }
+  free(s->seps.wide);
+  scan_fill_separators(&s->seps, separators, count, wide);
+  return 0;
+}
+
+// This function frees the scanned data and its document table
+static void free_data(Session *s) {
+  free(s->data);
+  if (s->docs != &s->whole)
+    free(s->docs);
+  s->data = NULL;
+  s->data_len = 0;
+  s->docs = NULL;
+  s->doc_count = 0;
+}
+
+// This function opens a session with the default separators
+static void sc_open(fuse_req_t req, struct fuse_file_info *fi) {
+  static const char defaults[] = { ' ', '\t', '\n', ':' };
+  Session *s = calloc(1, sizeof(*s));
+
+  if (!s || !(s->separators = malloc(sizeof(defaults)))) {
+    free(s);
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+  pthread_mutex_init(&s->lock, NULL);
+  memcpy(s->separators, defaults, sizeof(defaults));
+  s->sep_count = sizeof(defaults);
+  build_separators(s, s->separators, s->sep_count); // cannot fail in byte mode
+  s->pages = options.buffer_pages & (SCANNER_PAGES_LOCAL | SCANNER_PAGES_HUGE);
+
+  fi->fh = (uintptr_t)s;
+  fi->direct_io = 1;
+  fi->nonseekable = 1;
+  fuse_reply_open(req, fi);
+}
+
+// This function frees a session when its file is closed
+static void sc_release(fuse_req_t req, struct fuse_file_info *fi) {
+  Session *s = session(fi);
+  free_data(s);
+  free(s->pending);
+  free(s->separators);
+  free(s->seps.wide);
+  free(s->xlat);
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+  fuse_reply_err(req, 0);
+}
+
+// This function allocates count bytes of data as the session's SCANNER_PAGES_* flags ask.
+// With SCANNER_PAGES_HUGE, 2 MB or more are aligned to huge pages and advised for THP.
+// SCANNER_PAGES_LOCAL needs nothing here: memcpy() first touches the pages on the writing thread's node.
+static char *alloc_data(Session *s, size_t count) {
+  size_t size = (count + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  void *data;
+
+  if (!(s->pages & SCANNER_PAGES_HUGE) || count < HUGE_PAGE_SIZE)
+    return malloc(count ? count : 1);
+  if (posix_memalign(&data, HUGE_PAGE_SIZE, size))
+    return NULL;
+  madvise(data, size, MADV_HUGEPAGE); // only advice: base pages still work
+  return data;
+}
+
+// This function makes the assembled write() the data to scan: it splits batch documents and
+// resets the scanning position. Malformed batch data is dropped and the old data stays in place,
+// as after a failed write in the module.
+static long finish_write(Session *s) {
+  char *data = s->pending;
+  size_t count = s->pending_len;
+  ScanDoc *docs = NULL;
+  long n = 1;
+
+  if (!data)
+    return 0;
+  s->pending = NULL;
+  s->pending_len = 0;
+  s->pending_size = 0;
+  if (s->batch_mode) {
+    n = scan_count_documents(data, count);
+    if (n < 0) {
+      free(data);
+      return n;
+    }
+    docs = malloc((n ? n : 1) * sizeof(*docs));
+    if (!docs) {
+      free(data);
+      return -ENOMEM;
+    }
+    scan_fill_documents(data, count, docs);
+  }
+
+  // swap in the new data
+  free_data(s);
+  s->data = data;
+  s->data_len = count;
+  if (docs) {
+    s->docs = docs;
+  } else {
+    s->whole.start = 0;
+    s->whole.end = count;
+    s->docs = &s->whole;
+  }
+  s->doc_count = n;
+
+  // reset scanning position
+  s->doc = 0;
+  s->pos = s->doc_count ? s->docs[0].start : 0;
+  s->token_start = 0;
+  s->token_end = 0;
+  s->token_read_pos = 0;
+  return 0;
+}
+
+// This function appends count bytes at offset off to the write() being assembled.
+// Offset 0 starts a new one; any other offset must continue the current one.
+static long append_pending(Session *s, const char *buf, size_t count, off_t off) {
+  size_t total = off + count;
+
+  if (off == 0) {
+    free(s->pending);
+    s->pending = NULL;
+    s->pending_len = 0;
+    s->pending_size = 0;
+  } else if (!s->pending || (size_t)off != s->pending_len) {
+    return -EINVAL; // not the next piece of a write() being assembled
+  }
+  if (!s->pending || total > s->pending_size) {
+    // grow geometrically, so a large write() is copied O(1) times per byte
+    size_t size = (total > 2 * s->pending_size) ? total : 2 * s->pending_size;
+    char *pending = alloc_data(s, size);
+    if (!pending)
+      return -ENOMEM;
+    if (s->pending_len)
+      memcpy(pending, s->pending, s->pending_len);
+    free(s->pending);
+    s->pending = pending;
+    s->pending_size = size;
+  }
+  memcpy(s->pending + s->pending_len, buf, count);
+  s->pending_len = total;
+  return count;
+}
+
+// This function handles one piece of a write(), at offset off within it:
+// writing separators, or writing data to be scanned
+static long do_write(Session *s, const char *buf, size_t count, off_t off) {
+  size_t total = off + count;
+  long result;
+
+  if ((options.max_bytes && total > options.max_bytes) || (s->max_bytes && total > s->max_bytes))
+    return -ENOSPC;
+
+  // Write set separators = MODE 1
+  if (s->config_mode) {
+    char *separators = malloc(count ? count : 1);
+    int err;
+    if (off != 0)
+      return -EINVAL; // separator sets are far shorter than one piece
+    if (!separators)
+      return -ENOMEM;
+    memcpy(separators, buf, count);
+    err = build_separators(s, separators, count);
+    if (err) {
+      free(separators);
+      return err;
+    }
+    free(s->separators);
+    s->separators = separators;
+    s->sep_count = count;
+    s->config_mode = 0;
+    return count;
+  }
+
+  // Write data to be scanned = MODE 0
+  // assemble the pieces aside, so the old data stays until the whole write() is in
+  result = append_pending(s, buf, count, off);
+  if (result < 0)
+    return result;
+  // a short piece is the last one; otherwise the next request finishes the write()
+  if (count <= LAST_PIECE_MAX) {
+    long err = finish_write(s);
+    if (err)
+      return err;
+  }
+  return result;
+}
+
+static void sc_write(fuse_req_t req, const char *buf, size_t size, off_t off, struct fuse_file_info *fi) {
+  Session *s = session(fi);
+  long result;
+  pthread_mutex_lock(&s->lock);
+  if (off == 0)
+    finish_write(s); // an earlier write() that ended on a full piece
+  result = do_write(s, buf, size, off);
+  pthread_mutex_unlock(&s->lock);
+  reply_write(req, result);
+}
+
+// This function finds the next token, as next_token() in scanner.c
+static int next_token(Session *s) {
+  if (!scan_next_token(&s->seps, s->data, s->docs, s->doc_count,
+                       &s->doc, &s->pos, &s->token_start, &s->token_end))
+    return 0;
+  s->token_read_pos = 0;
+  return 1;
+}
+
+// This function replies with token records in metadata mode
+static void read_meta(fuse_req_t req, Session *s, size_t count) {
+  size_t max = count / sizeof(struct scanner_token);
+  struct scanner_token *recs;
+  size_t n = 0;
+
+  if (max == 0) {
+    fuse_reply_err(req, EINVAL); // buffer cannot hold a single record
+    return;
+  }
+  recs = malloc(max * sizeof(*recs));
+  if (!recs) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+  // a token partially returned as bytes is skipped
+  if (s->token_start < s->token_end)
+    s->pos = s->token_end;
+  while (n < max && next_token(s)) {
+    recs[n].start = s->token_start;
+    recs[n].len = s->token_end - s->token_start;
+    recs[n].sep = (s->token_end < s->docs[s->doc].end) ?
+      scan_separator_value(&s->seps, s->data, s->token_end, s->docs[s->doc].end) : SCANNER_SEP_EOF;
+    recs[n].doc = s->doc;
+    n++;
+  }
+  s->token_start = 0;
+  s->token_end = 0;
+  s->token_read_pos = 0;
+
+  if (n == 0)
+    fuse_reply_err(req, EPERM); // no more tokens
+  else
+    fuse_reply_buf(req, (const char *)recs, n * sizeof(*recs));
+  free(recs);
+}
+
+// This function replies with the next part of the current token, at most count bytes
+static void read_token_part(fuse_req_t req, Session *s, size_t count) {
+  const char *part = s->data + s->token_start + s->token_read_pos;
+  size_t remaining = s->token_end - s->token_start - s->token_read_pos;
+  size_t to_send = (remaining < count) ? remaining : count;
+  char *mapped;
+  size_t i;
+
+  // in UTF-8 mode a partial read never ends inside a code point
+  if (s->seps.utf8 && to_send < remaining) {
+    to_send = scan_utf8_trim(part, to_send, remaining);
+    if (to_send == 0 && count > 0) {
+      fuse_reply_err(req, EINVAL); // buffer cannot hold the next code point
+      return;
+    }
+  }
+  s->token_read_pos += to_send;
+  if (!s->xlat) {
+    fuse_reply_buf(req, part, to_send);
+    return;
+  }
+  mapped = malloc(to_send ? to_send : 1);
+  if (!mapped) {
+    s->token_read_pos -= to_send;
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+  for (i = 0; i < to_send; i++)
+    mapped[i] = s->xlat[(unsigned char)part[i]];
+  fuse_reply_buf(req, mapped, to_send);
+  free(mapped);
+}
+
+// This function reads tokens from the scanned data, as read() in scanner.c
+static void do_read(fuse_req_t req, Session *s, size_t count) {
+  // no data to scan
+  if (!s->data || s->data_len == 0) {
+    fuse_reply_err(req, EPERM);
+    return;
+  }
+  if (s->meta_mode) {
+    read_meta(req, s, count);
+    return;
+  }
+  // Continuing reading from current token if not fully read
+  if (s->token_start < s->token_end) {
+    if (s->token_read_pos < s->token_end - s->token_start) {
+      read_token_part(req, s, count);
+      return;
+    }
+    // token fully read, reset for next token
+    s->pos = s->token_end;
+    s->token_start = 0;
+    s->token_end = 0;
+    s->token_read_pos = 0;
+    fuse_reply_buf(req, NULL, 0);
+    return;
+  }
+  // Scan for next token
+  if (!next_token(s)) {
+    fuse_reply_err(req, EPERM); // no more tokens
+    return;
+  }
+  read_token_part(req, s, count);
+}
+
+// The kernel asks for more of a read() at off > 0 only after a full piece: an empty reply ends the
+// read() there, so the next read() sees the end of the token (0) or the next records
+static void sc_read(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi) {
+  Session *s = session(fi);
+  pthread_mutex_lock(&s->lock);
+  finish_write(s);
+  if (off > 0)
+    fuse_reply_buf(req, NULL, 0);
+  else
+    do_read(req, s, size);
+  pthread_mutex_unlock(&s->lock);
+}
+
+// This function asks the kernel for size bytes at the caller's arg.
+// It returns 1 once they are in in_buf, or 0 after requesting a retry.
+static int want_in(fuse_req_t req, void *arg, size_t size, size_t in_bufsz) {
+  struct iovec iov = { arg, size };
+  if (in_bufsz >= size)
+    return 1;
+  fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+  return 0;
+}
+
+// This function asks the kernel for room for size bytes at the caller's arg.
+// It returns 1 once the reply can carry them, or 0 after requesting a retry.
+static int want_out(fuse_req_t req, void *arg, size_t size, size_t out_bufsz) {
+  struct iovec iov = { arg, size };
+  if (out_bufsz >= size)
+    return 1;
+  fuse_reply_ioctl_retry(req, NULL, 0, &iov, 1);
+  return 0;
+}
+
+// This function moves the scan cursor, with the same checks as set_cursor() in scanner.c
+static int set_cursor(Session *s, const struct scanner_cursor *cursor) {
+  size_t start, end;
+
+  if (cursor->doc > s->doc_count)
+    return -EINVAL;
+  start = (cursor->doc < s->doc_count) ? s->docs[cursor->doc].start : 0;
+  end = (cursor->doc < s->doc_count) ? s->docs[cursor->doc].end : s->data_len;
+  if (cursor->pos < start || cursor->pos > end)
+    return -EINVAL;
+  if (cursor->token_start < cursor->token_end &&
+      (cursor->token_start < start || cursor->token_end != cursor->pos ||
+       cursor->token_read_pos > cursor->token_end - cursor->token_start))
+    return -EINVAL;
+
+  s->doc = cursor->doc;
+  s->pos = cursor->pos;
+  if (cursor->token_start < cursor->token_end) {
+    s->token_start = cursor->token_start;
+    s->token_end = cursor->token_end;
+    s->token_read_pos = cursor->token_read_pos;
+  } else {
+    s->token_start = 0;
+    s->token_end = 0;
+    s->token_read_pos = 0;
+  }
+  return 0;
+}
+
+// This function handles the ioctl requests of scanner.h.
+// Requests returning or linking kernel file descriptors (DUP, RING, RING_ATTACH) are module-only.
+static int do_ioctl(fuse_req_t req, Session *s, unsigned int cmd, void *arg,
+                    const void *in_buf, size_t in_bufsz, size_t out_bufsz) {
+  if (cmd == SCANNER_IOC_CONFIG) { // set configuration mode
+    s->config_mode = 1;
+    free(s->separators);
+    s->separators = NULL;
+    s->sep_count = 0;
+    build_separators(s, NULL, 0); // cannot fail without separators
+    return 0;
+  }
+  if (cmd == SCANNER_IOC_META) {
+    s->meta_mode = (arg != NULL);
+    return 0;
+  }
+  if (cmd == SCANNER_IOC_BATCH) {
+    s->batch_mode = (arg != NULL);
+    return 0;
+  }
+  if (cmd == SCANNER_IOC_GET_CURSOR) {
+    struct scanner_cursor cursor = {
+      .pos = s->pos,
+      .token_start = s->token_start,
+      .token_end = s->token_end,
+      .token_read_pos = s->token_read_pos,
+      .doc = s->doc,
+    };
+    if (want_out(req, arg, sizeof(cursor), out_bufsz))
+      fuse_reply_ioctl(req, 0, &cursor, sizeof(cursor));
+    return 1; // replied
+  }
+  if (cmd == SCANNER_IOC_SET_CURSOR) {
+    struct scanner_cursor cursor;
+    if (!want_in(req, arg, sizeof(cursor), in_bufsz))
+      return 1; // replied
+    memcpy(&cursor, in_buf, sizeof(cursor));
+    return set_cursor(s, &cursor);
+  }
+  if (cmd == SCANNER_IOC_LIMIT) {
+    s->max_bytes = (uintptr_t)arg;
+    return 0;
+  }
+  if (cmd == SCANNER_IOC_PAGES) {
+    if ((uintptr_t)arg & ~(uintptr_t)(SCANNER_PAGES_LOCAL | SCANNER_PAGES_HUGE))
+      return -EINVAL;
+    s->pages = (uintptr_t)arg;
+    return 0;
+  }
+  if (cmd == SCANNER_IOC_UTF8) {
+    int old = s->seps.utf8;
+    int err;
+    s->seps.utf8 = (arg != NULL);
+    err = build_separators(s, s->separators, s->sep_count);
+    if (err)
+      s->seps.utf8 = old; // current separators are not valid UTF-8
+    return err;
+  }
+  if (cmd == SCANNER_IOC_XLAT) {
+    const unsigned char *table = in_buf;
+    unsigned char *xlat;
+    int i;
+    if (!arg) {
+      free(s->xlat);
+      s->xlat = NULL;
+      return 0;
+    }
+    if (!want_in(req, arg, 256, in_bufsz))
+      return 1; // replied
+    // an identity table is dropped so reads keep the plain copy, as in the module
+    for (i = 0; i < 256 && table[i] == i; i++)
+      ;
+    if (i == 256) {
+      free(s->xlat);
+      s->xlat = NULL;
+      return 0;
+    }
+    xlat = malloc(256);
+    if (!xlat)
+      return -ENOMEM;
+    memcpy(xlat, table, 256);
+    free(s->xlat);
+    s->xlat = xlat;
+    return 0;
+  }
+  if (cmd == SCANNER_IOC_DUP || cmd == SCANNER_IOC_RING || cmd == SCANNER_IOC_RING_ATTACH)
+    return -EOPNOTSUPP;
+  return -ENOTTY;
+}
+
+static void sc_ioctl(fuse_req_t req, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags,
+                     const void *in_buf, size_t in_bufsz, size_t out_bufsz) {
+  Session *s = session(fi);
+  int result;
+
+  if (flags & FUSE_IOCTL_COMPAT) {
+    fuse_reply_err(req, ENOSYS);
+    return;
+  }
+  pthread_mutex_lock(&s->lock);
+  finish_write(s);
+  result = do_ioctl(req, s, (unsigned int)cmd, arg, in_buf, in_bufsz, out_bufsz);
+  pthread_mutex_unlock(&s->lock);
+  if (result < 0)
+    fuse_reply_err(req, -result);
+  else if (result == 0)
+    fuse_reply_ioctl(req, 0, NULL, 0);
+}
+
+static const struct cuse_lowlevel_ops ops = {
+  .open = sc_open,
+  .release = sc_release,
+  .read = sc_read,
+  .write = sc_write,
+  .ioctl = sc_ioctl,
+};
+
+int main(int argc, char *argv[]) {
+  struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+  struct cuse_info ci;
+  char dev_name[128];
+  const char *dev_info_argv[] = { dev_name };
+
+  if (fuse_opt_parse(&args, &options, option_spec, NULL) == -1)
+    return 1;
+  snprintf(dev_name, sizeof(dev_name), "DEVNAME=%s", options.name ? options.name : "scanner-cuse");
+
+  memset(&ci, 0, sizeof(ci));
+  ci.dev_info_argc = 1;
+  ci.dev_info_argv = dev_info_argv;
+  ci.flags = CUSE_UNRESTRICTED_IOCTL; // needed for SCANNER_IOC_XLAT with a NULL table
+  return cuse_lowlevel_main(args.argc, args.argv, &ci, &ops, NULL);
+}
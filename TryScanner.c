@@ -12,6 +12,9 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+
+#include "scanner.h"
 
 #define ERR(s) err(s,__FILE__,__LINE__)
 
@@ -20,11 +23,13 @@ static void err(char *s, char *file, int line) {
   exit(1);
 }
 
+static const char *device_path = "/dev/scanner"; // device under test
+
 // Test 1: Default separators
 // It uses space, tab, newline, and colon as default separators.
 void test1_default_separators() {
   printf("Test 1: Default Separators\n");
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){ 
     ERR("open() failed");
   }
@@ -62,7 +67,7 @@ void test1_default_separators() {
 // custom separators '-' and ','
 void test2_custom_separators() {
   printf("Test 2: Custom Separators\n");
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){
     ERR("open() failed");
   }
@@ -112,7 +117,7 @@ void test2_custom_separators() {
 // Each write replaces previous data
 void test3_non_cumulative_writes() {
   printf("Test 3: Non-Cumulative Writes\n");
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){
     ERR("open() failed");
   }
@@ -170,7 +175,7 @@ void test3_non_cumulative_writes() {
 // Test 4: Partial reads (token larger than buffer)
 void test4_partial_reads() {
   printf("Test 4: Partial Reads\n");
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){
     ERR("open() failed");
   }
@@ -224,7 +229,7 @@ void test4_partial_reads() {
 // This test writes data containing NUL bytes and verifies correct tokenization.
 void test5_nul_bytes() {
   printf("Test 5: NUL Byte Handling\n");
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){
     ERR("open() failed");
   }
@@ -285,7 +290,7 @@ void test5_nul_bytes() {
 // This test writes zero bytes to the device and verifies behavior.
 void test6_empty_write() {
   printf("Test 6: Empty write\n");
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){
     ERR("open() failed");
   }
@@ -313,7 +318,7 @@ void test6_empty_write() {
 // This test sets multiple separators and verifies correct tokenization.
 void test7_multiple_separators() {
   printf("Test 7: Multiple Separators\n");
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){
     ERR("open() failed");
   }
@@ -358,8 +363,8 @@ void test7_multiple_separators() {
 void test8_multiple_instances() {
   printf("Test 8: Multiple Instances\n");
   
-  int fd1 = open("/dev/scanner", O_RDWR);
-  int fd2 = open("/dev/scanner", O_RDWR);
+  int fd1 = open(device_path, O_RDWR);
+  int fd2 = open(device_path, O_RDWR);
   
   if (fd1 < 0 || fd2 < 0) {
       ERR("Failed to open two instances");
@@ -441,7 +446,7 @@ void test8_multiple_instances() {
 void test9_null_separator() {
   printf("Test 9: Null Separator\n");
 
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){
     ERR("open() failed");
   }
@@ -495,7 +500,7 @@ void test9_null_separator() {
 // This test sets no separators and verifies that the entire input is treated as a single token.
 void test10_no_separators() {
   printf("Test 10: No Separators\n");
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){
     ERR("open() failed");
   }
@@ -554,7 +559,7 @@ void test11_stress_test() {
   // Repeat open, write, read, close multiple times
   for (int i = 0; i < iterations; i++) 
   {
-    int fd=open("/dev/scanner",O_RDWR); // open device
+    int fd=open(device_path,O_RDWR); // open device
     if (fd<0){
      printf("  FAIL: could not open device at iteration %d\n", i);
      pass = 0;
@@ -602,7 +607,7 @@ void test11_stress_test() {
 // this test checks that invalid ioctl commands return -ENOTTY
 void test12_invalid_ioctl() {
   printf("Test 12: Invalid IOCTL Handling\n");
-  int fd=open("/dev/scanner",O_RDWR); // open device
+  int fd=open(device_path,O_RDWR); // open device
   if (fd<0){
     ERR("open() failed");
   }
@@ -620,9 +625,719 @@ void test12_invalid_ioctl() {
   close(fd);
 }
 
-int main() {
+// Test 13: Metadata mode
+// This test reads token records (offset, length, separator) instead of token bytes.
+void test13_metadata_mode() {
+  printf("Test 13: Metadata Mode\n");
+  int fd=open(device_path,O_RDWR); // open device
+  if (fd<0){
+    ERR("open() failed");
+  }
+  int pass = 1; // flag to track test pass/fail
+
+  if (ioctl(fd,SCANNER_IOC_META,1)<0) // switch to metadata mode
+    ERR("ioctl() failed");
+
+  const char *data="key:value\nnext record";
+  if (write(fd,data,strlen(data))<0) // write data to device
+    ERR("write() failed");
+
+  const struct scanner_token expected[] = {
+    { 0, 3, ':', 0 }, { 4, 5, '\n', 0 }, { 10, 4, ' ', 0 }, { 15, 6, SCANNER_SEP_EOF, 0 }
+  };
+  struct scanner_token recs[3]; // smaller than the token count to force two reads
+  int token = 0;
+  int len;
+
+  while (1) {
+    len = read(fd, recs, sizeof(recs)); // read token records
+    if (len <= 0) // end of data (-1)
+      break;
+    for (int i = 0; i < len / (int)sizeof(recs[0]); i++, token++) {
+      printf("  Token %d: start=%llu len=%llu sep=%d \"%.*s\"\n", token,
+             (unsigned long long)recs[i].start, (unsigned long long)recs[i].len, recs[i].sep,
+             (int)recs[i].len, data + recs[i].start);
+      if (token >= 4 || recs[i].start != expected[token].start ||
+          recs[i].len != expected[token].len || recs[i].sep != expected[token].sep)
+        pass = 0; // unexpected record
+    }
+  }
+  if (token != 4)
+    pass = 0; // incorrect number of tokens
+
+  if (pass)
+    printf("Test 13 result: PASS\n");
+  else
+    printf("Test 13 result: FAIL\n");
+  close(fd);
+}
+
+// Test 14: Batch mode
+// This test writes several length-prefixed documents at once and checks the document index of each token.
+void test14_batch_mode() {
+  printf("Test 14: Batch Mode\n");
+  int fd=open(device_path,O_RDWR); // open device
+  if (fd<0){
+    ERR("open() failed");
+  }
+  int pass = 1; // flag to track test pass/fail
+
+  if (ioctl(fd,SCANNER_IOC_BATCH,1)<0) // writes carry documents
+    ERR("ioctl() failed");
+  if (ioctl(fd,SCANNER_IOC_META,1)<0) // read token records
+    ERR("ioctl() failed");
+
+  // three documents: "a b", "" and "cd:e", each after its __u32 length
+  const char *docs[] = { "a b", "", "cd:e" };
+  char data[64];
+  int data_len = 0;
+  for (int i = 0; i < 3; i++) {
+    __u32 n = strlen(docs[i]);
+    memcpy(data + data_len, &n, sizeof(n));
+    memcpy(data + data_len + sizeof(n), docs[i], n);
+    data_len += sizeof(n) + n;
+  }
+  if (write(fd,data,data_len)<0) // write data to device
+    ERR("write() failed");
+
+  // a document running past the end of the write is rejected, keeping the data above
+  __u32 bad = 10;
+  errno = 0;
+  if (write(fd, &bad, sizeof(bad)) != -1 || errno != EINVAL)
+    pass = 0;
+
+  const char *expected[] = { "a", "b", "cd", "e" };
+  const __u32 expected_doc[] = { 0, 0, 2, 2 };
+  struct scanner_token recs[8];
+  int len = read(fd, recs, sizeof(recs)); // read all token records
+  int token = (len > 0) ? len / (int)sizeof(recs[0]) : 0;
+
+  for (int i = 0; i < token; i++) {
+    printf("  Token %d: doc=%u \"%.*s\" sep=%d\n", i, recs[i].doc,
+           (int)recs[i].len, data + recs[i].start, recs[i].sep);
+    if (i >= 4 || recs[i].doc != expected_doc[i] || recs[i].len != strlen(expected[i]) ||
+        memcmp(data + recs[i].start, expected[i], recs[i].len) != 0)
+      pass = 0; // unexpected record
+  }
+  if (token != 4 || read(fd, recs, sizeof(recs)) != -1)
+    pass = 0; // incorrect number of tokens
+
+  if (pass)
+    printf("Test 14 result: PASS\n");
+  else
+    printf("Test 14 result: FAIL\n");
+  close(fd);
+}
+
+// This function reads the next whole token into buf, returns its length or -1 at end of data
+static int read_token(int fd, char *buf, int size) {
+  int len = read(fd, buf, size - 1);
+  if (len < 0)
+    return -1;
+  buf[len] = 0;
+  if (len > 0 && read(fd, buf + len, 1) != 0) // consume end of token
+    return -1;
+  return len;
+}
+
+// Test 15: Cursor checkpoint and duplicate sessions
+// This test saves and restores the scan cursor and scans one buffer from two fds.
+void test15_cursor_and_dup() {
+  printf("Test 15: Cursor and Duplicate Sessions\n");
+  int fd=open(device_path,O_RDWR); // open device
+  if (fd<0){
+    ERR("open() failed");
+  }
+  int pass = 1; // flag to track test pass/fail
+  char buf[128];
+
+  const char *data="one two three four";
+  if (write(fd,data,strlen(data))<0) // write data to device
+    ERR("write() failed");
+
+  struct scanner_cursor cursor;
+  read_token(fd, buf, sizeof(buf)); // "one"
+  if (ioctl(fd,SCANNER_IOC_GET_CURSOR,&cursor)<0) // checkpoint after "one"
+    ERR("ioctl() failed");
+  read_token(fd, buf, sizeof(buf)); // "two"
+  read_token(fd, buf, sizeof(buf)); // "three"
+  if (ioctl(fd,SCANNER_IOC_SET_CURSOR,&cursor)<0) // back to after "one"
+    ERR("ioctl() failed");
+  read_token(fd, buf, sizeof(buf));
+  printf("  after restore: \"%s\"\n", buf);
+  if (strcmp(buf, "two") != 0)
+    pass = 0;
+
+  // a cursor outside the data is rejected
+  struct scanner_cursor bad = cursor;
+  bad.pos = 1000;
+  errno = 0;
+  if (ioctl(fd,SCANNER_IOC_SET_CURSOR,&bad) != -1 || errno != EINVAL)
+    pass = 0;
+
+  // the duplicate continues from the same place
+  int dup_fd = ioctl(fd,SCANNER_IOC_DUP,0);
+  if (dup_fd < 0 && errno == EOPNOTSUPP) { // only the kernel module hands out new fds
+    printf("Test 15 result: %s (no duplicate sessions on this device)\n", pass ? "PASS" : "FAIL");
+    close(fd);
+    return;
+  }
+  if (dup_fd < 0)
+    ERR("ioctl() failed");
+  read_token(dup_fd, buf, sizeof(buf));
+  printf("  duplicate: \"%s\"\n", buf);
+  if (strcmp(buf, "three") != 0)
+    pass = 0;
+
+  // new data on the original leaves the duplicate alone
+  if (write(fd,"replaced",8)<0)
+    ERR("write() failed");
+  read_token(dup_fd, buf, sizeof(buf));
+  printf("  duplicate after write: \"%s\"\n", buf);
+  if (strcmp(buf, "four") != 0 || read_token(dup_fd, buf, sizeof(buf)) != -1)
+    pass = 0;
+  read_token(fd, buf, sizeof(buf));
+  printf("  original after write: \"%s\"\n", buf);
+  if (strcmp(buf, "replaced") != 0)
+    pass = 0;
+
+  if (pass)
+    printf("Test 15 result: PASS\n");
+  else
+    printf("Test 15 result: FAIL\n");
+  close(dup_fd);
+  close(fd);
+}
+
+// Test 16: Per-session memory limit
+// This test lowers the session's write limit and checks that larger writes fail with ENOSPC.
+void test16_memory_limit() {
+  printf("Test 16: Memory Limit\n");
+  int fd=open(device_path,O_RDWR); // open device
+  if (fd<0){
+    ERR("open() failed");
+  }
+  int pass = 1; // flag to track test pass/fail
+  char buf[128];
+
+  if (write(fd,"kept data",9)<0) // write data to device
+    ERR("write() failed");
+  if (ioctl(fd,SCANNER_IOC_LIMIT,8)<0) // at most 8 bytes per write
+    ERR("ioctl() failed");
+
+  errno = 0;
+  if (write(fd,"too much data",13) != -1 || errno != ENOSPC) {
+    printf("  FAIL: oversized write was not refused\n");
+    pass = 0;
+  }
+  // the refused write leaves the old data in place
+  read_token(fd, buf, sizeof(buf));
+  printf("  after refused write: \"%s\"\n", buf);
+  if (strcmp(buf, "kept") != 0)
+    pass = 0;
+  if (write(fd,"fits",4) != 4)
+    pass = 0;
+
+  // report device-wide usage when the module exposes it
+  FILE *f = fopen("/sys/module/scanner/parameters/mem_peak", "r");
+  if (f) {
+    long peak;
+    if (fscanf(f, "%ld", &peak) == 1)
+      printf("  mem_peak: %ld bytes\n", peak);
+    fclose(f);
+  }
+
+  if (pass)
+    printf("Test 16 result: PASS\n");
+  else
+    printf("Test 16 result: FAIL\n");
+  close(fd);
+}
+
+// Test 17: UTF-8 separators
+// This test splits on non-ASCII separators and checks that partial reads never cut a code point.
+void test17_utf8_separators() {
+  printf("Test 17: UTF-8 Separators\n");
+  int fd=open(device_path,O_RDWR); // open device
+  if (fd<0){
+    ERR("open() failed");
+  }
+  int pass = 1; // flag to track test pass/fail
+
+  if (ioctl(fd,SCANNER_IOC_UTF8,1)<0) // separators are code points
+    ERR("ioctl() failed");
+  if (ioctl(fd,0,0)<0) // Switch to configuration mode
+    ERR("ioctl() failed");
+  const char *separators=" \u00A0\u3000\u3001"; // space, NBSP, ideographic space and comma
+  if (write(fd,separators,strlen(separators))<0)
+    ERR("write() failed to set separators");
+
+  const char *data="h\u00E9llo\u00A0w\u00F6rld\u3000\u65E5\u672C\u3001end";
+  if (write(fd,data,strlen(data))<0) // write data to device
+    ERR("write() failed");
+
+  // read with a 4-byte buffer: chunks must stay whole code points
+  const char *expected[] = { "h\u00E9llo", "w\u00F6rld", "\u65E5\u672C", "end" };
+  char token_buf[64];
+  int token_len = 0;
+  int token = 0;
+  char buf[4];
+  int len;
+  while (1) {
+    len = read(fd, buf, sizeof(buf));
+    if (len > 0) {
+      // a chunk ending in a lead byte would have split a code point
+      if ((buf[len - 1] & 0xC0) == 0xC0)
+        pass = 0;
+      memcpy(token_buf + token_len, buf, len);
+      token_len += len;
+    } else if (len == 0) {
+      token_buf[token_len] = 0;
+      printf("  Token %d: \"%s\"\n", token, token_buf);
+      if (token >= 4 || strcmp(token_buf, expected[token]) != 0)
+        pass = 0; // unexpected token
+      token_len = 0;
+      token++;
+    } else {
+      break;
+    }
+  }
+  if (token != 4)
+    pass = 0; // incorrect number of tokens
+
+  // a 1-byte buffer cannot hold a 3-byte code point
+  if (write(fd,"\u65E5",3)<0)
+    ERR("write() failed");
+  errno = 0;
+  if (read(fd, buf, 1) != -1 || errno != EINVAL)
+    pass = 0;
+
+  // records report the separator code point
+  struct scanner_token recs[4];
+  if (ioctl(fd,SCANNER_IOC_META,1)<0)
+    ERR("ioctl() failed");
+  if (write(fd,data,strlen(data))<0)
+    ERR("write() failed");
+  len = read(fd, recs, sizeof(recs));
+  if (len != (int)sizeof(recs) || recs[0].sep != 0xA0 || recs[1].sep != 0x3000 ||
+      recs[2].sep != 0x3001 || recs[3].sep != SCANNER_SEP_EOF)
+    pass = 0;
+
+  // invalid UTF-8 separators are refused
+  if (ioctl(fd,0,0)<0)
+    ERR("ioctl() failed");
+  errno = 0;
+  if (write(fd,"\xC3",1) != -1 || errno != EINVAL)
+    pass = 0;
+
+  if (pass)
+    printf("Test 17 result: PASS\n");
+  else
+    printf("Test 17 result: FAIL\n");
+  close(fd);
+}
+
+// Test 18: Byte translation on read
+// This test installs a lowercase table and checks tokens come back folded.
+void test18_translation_table() {
+  printf("Test 18: Translation Table\n");
+  int fd=open(device_path,O_RDWR); // open device
+  if (fd<0){
+    ERR("open() failed");
+  }
+  int pass = 1; // flag to track test pass/fail
+  char buf[128];
+
+  unsigned char table[256];
+  for (int i = 0; i < 256; i++)
+    table[i] = (i >= 'A' && i <= 'Z') ? i - 'A' + 'a' : i;
+  if (ioctl(fd,SCANNER_IOC_XLAT,table)<0) // fold case on read
+    ERR("ioctl() failed");
+
+  const char *data="Hello:WORLD";
+  if (write(fd,data,strlen(data))<0) // write data to device
+    ERR("write() failed");
+  read_token(fd, buf, sizeof(buf));
+  printf("  Token 0: \"%s\"\n", buf);
+  if (strcmp(buf, "hello") != 0)
+    pass = 0;
+  // partial reads are translated too
+  int len = read(fd, buf, 3);
+  buf[len > 0 ? len : 0] = 0;
+  printf("  Partial token 1: \"%s\"\n", buf);
+  if (strcmp(buf, "wor") != 0)
+    pass = 0;
+
+  // back to identity
+  if (ioctl(fd,SCANNER_IOC_XLAT,NULL)<0)
+    ERR("ioctl() failed");
+  if (write(fd,data,strlen(data))<0)
+    ERR("write() failed");
+  read_token(fd, buf, sizeof(buf));
+  printf("  Identity token 0: \"%s\"\n", buf);
+  if (strcmp(buf, "Hello") != 0)
+    pass = 0;
+
+  if (pass)
+    printf("Test 18 result: PASS\n");
+  else
+    printf("Test 18 result: FAIL\n");
+  close(fd);
+}
+
+// Test 19: Producer/consumer ring
+// This test links two fds through a small ring and streams tokens across its wrap-around.
+void test19_ring() {
+  printf("Test 19: Producer/Consumer Ring\n");
+  int producer=open(device_path,O_RDWR|O_NONBLOCK); // open device
+  int consumer=open(device_path,O_RDWR|O_NONBLOCK);
+  if (producer<0 || consumer<0){
+    ERR("open() failed");
+  }
+  int pass = 1; // flag to track test pass/fail
+  char buf[128];
+
+  struct scanner_ring ring = { 16, 0, 0 }; // 16-byte ring
+  if (ioctl(producer,SCANNER_IOC_RING,&ring)<0) {
+    if (errno == EOPNOTSUPP) { // only the kernel module links fds
+      printf("Test 19 result: SKIP (no rings on this device)\n");
+      close(producer);
+      close(consumer);
+      return;
+    }
+    ERR("ioctl() failed to create ring");
+  }
+
+  if (ioctl(consumer,SCANNER_IOC_RING_ATTACH,producer)<0)
+    ERR("ioctl() failed to attach ring");
+
+  // rings return plain token bytes: other read modes are refused
+  errno = 0;
+  if (ioctl(consumer,SCANNER_IOC_META,1) != -1 || errno != EINVAL)
+    pass = 0;
+  // a nonzero pad or a ring over 1 GB is refused
+  int other=open(device_path,O_RDWR);
+  if (other<0){
+    ERR("open() failed");
+  }
+  struct scanner_ring padded = { 16, 0, 1 };
+  struct scanner_ring huge = { 1ULL << 31, 0, 0 };
+  errno = 0;
+  if (ioctl(other,SCANNER_IOC_RING,&padded) != -1 || errno != EINVAL)
+    pass = 0;
+  errno = 0;
+  if (ioctl(other,SCANNER_IOC_RING,&huge) != -1 || errno != EINVAL)
+    pass = 0;
+  close(other);
+
+  // an empty ring has nothing to read yet
+  errno = 0;
+  if (read(consumer, buf, sizeof(buf)) != -1 || errno != EAGAIN)
+    pass = 0;
+
+  // a full ring takes only what fits
+  const char *data="alpha beta gamma delta";
+  int sent = write(producer, data, strlen(data));
+  printf("  first write took %d bytes\n", sent);
+  if (sent != 16)
+    pass = 0;
+
+  // drain tokens, topping up the ring as space frees up
+  const char *expected[] = { "alpha", "beta", "gamma", "delta" };
+  int token = 0;
+  int token_len = 0;
+  while (1) {
+    int len = read(consumer, buf + token_len, sizeof(buf) - 1 - token_len);
+    if (len > 0) {
+      token_len += len;
+    } else if (len == 0) {
+      buf[token_len] = 0;
+      printf("  Token %d: \"%s\"\n", token, buf);
+      if (token >= 4 || strcmp(buf, expected[token]) != 0)
+        pass = 0; // unexpected token
+      token_len = 0;
+      token++;
+    } else if (errno == EAGAIN) {
+      if (sent < (int)strlen(data)) {
+        int n = write(producer, data + sent, strlen(data) - sent);
+        if (n > 0)
+          sent += n;
+      } else {
+        close(producer); // no more data: the last token ends here
+        producer = -1;
+      }
+    } else {
+      break; // end of data (-1)
+    }
+  }
+  if (token != 4)
+    pass = 0; // incorrect number of tokens
+
+  if (pass)
+    printf("Test 19 result: PASS\n");
+  else
+    printf("Test 19 result: FAIL\n");
+  close(consumer);
+}
+
+// This function polls one fd for events without waiting and returns the events reported
+static short poll_now(int fd, short events) {
+  struct pollfd pfd = { fd, events, 0 };
+  if (poll(&pfd, 1, 0) < 0)
+    ERR("poll() failed");
+  return pfd.revents;
+}
+
+// Test 20: Poll readiness
+// This test checks that plain sessions are always ready, and that ring ends become
+// ready only when a read or write would not block (what io_uring waits on).
+void test20_poll() {
+  printf("Test 20: Poll Readiness\n");
+  int fd=open(device_path,O_RDWR); // open device
+  if (fd<0){
+    ERR("open() failed");
+  }
+  int pass = 1; // flag to track test pass/fail
+
+  // a session without a ring never blocks
+  if (poll_now(fd, POLLIN|POLLOUT) != (POLLIN|POLLOUT))
+    pass = 0;
+  close(fd);
+
+  int producer=open(device_path,O_RDWR|O_NONBLOCK);
+  int consumer=open(device_path,O_RDWR|O_NONBLOCK);
+  if (producer<0 || consumer<0){
+    ERR("open() failed");
+  }
+  struct scanner_ring ring = { 16, 0, 0 }; // 16-byte ring
+  if (ioctl(producer,SCANNER_IOC_RING,&ring)<0) {
+    if (errno != EOPNOTSUPP) // only the kernel module links fds
+      ERR("ioctl() failed to create ring");
+    printf("  rings are not supported by this device\n");
+    close(producer);
+    close(consumer);
+  } else {
+    if (ioctl(consumer,SCANNER_IOC_RING_ATTACH,producer)<0)
+      ERR("ioctl() failed to attach ring");
+
+    // empty ring: the consumer waits, the producer may write
+    short in = poll_now(consumer, POLLIN);
+    short out = poll_now(producer, POLLOUT);
+    printf("  empty ring: consumer %s, producer %s\n",
+           (in & POLLIN) ? "readable" : "not readable", (out & POLLOUT) ? "writable" : "not writable");
+    if ((in & POLLIN) || !(out & POLLOUT))
+      pass = 0;
+
+    // full ring: the consumer may read, the producer waits
+    if (write(producer, "0123456789abcdefXYZ", 19) != 16)
+      pass = 0;
+    in = poll_now(consumer, POLLIN);
+    out = poll_now(producer, POLLOUT);
+    printf("  full ring: consumer %s, producer %s\n",
+           (in & POLLIN) ? "readable" : "not readable", (out & POLLOUT) ? "writable" : "not writable");
+    if (!(in & POLLIN) || (out & POLLOUT))
+      pass = 0;
+
+    // a producer without a consumer reports an error
+    close(consumer);
+    if (!(poll_now(producer, POLLOUT) & POLLERR))
+      pass = 0;
+    close(producer);
+  }
+
+  if (pass)
+    printf("Test 20 result: PASS\n");
+  else
+    printf("Test 20 result: FAIL\n");
+}
+
+// Test 21: Specialized scan loops
+// This test scans with one separator set per specialized loop and checks the tokens.
+void test21_separator_sets() {
+  printf("Test 21: Specialized Scan Loops\n");
+  struct {
+    const char *loop;       // loop the driver should pick for these separators
+    const char *separators; // separators to set
+    int utf8;               // UTF-8 mode flag
+    const char *data;       // data to scan
+    const char *expected;   // tokens joined by '|'
+  } cases[] = {
+    { "none",    "",        0, "a b:c",              "a b:c" },
+    { "single",  ",",       0, ",a,,bc,d,",          "a|bc|d" },
+    { "single",  " ",       1, "h\xc3\xa9llo w\xc3\xb6rld", "h\xc3\xa9llo|w\xc3\xb6rld" },
+    { "table",   " \t\r",   0, " x:y\t\rz  w\r",      "x:y|z|w" },
+    { "table",   ":\n\t ",  0, "a:b c\td\n\ne:",       "a|b|c|d|e" },
+    { "table",   "-,;",     0, "a-b;;c,d-",          "a|b|c|d" },
+  };
+  int pass = 1; // flag to track test pass/fail
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    int fd=open(device_path,O_RDWR); // open device
+    if (fd<0){
+      ERR("open() failed");
+    }
+    if (cases[i].utf8 && ioctl(fd,SCANNER_IOC_UTF8,1)<0)
+      ERR("ioctl() failed to set UTF-8 mode");
+    if (ioctl(fd,0,0)<0)
+      ERR("ioctl() failed");
+    if (write(fd,cases[i].separators,strlen(cases[i].separators))<0)
+      ERR("write() failed to set separators");
+    if (write(fd,cases[i].data,strlen(cases[i].data))<0)
+      ERR("write() failed");
+
+    // join the tokens with '|'
+    char joined[128] = "";
+    char buf[64];
+    int len;
+    while ((len = read_token(fd, buf, sizeof(buf))) >= 0) {
+      if (joined[0])
+        strcat(joined, "|");
+      strcat(joined, buf);
+    }
+    printf("  %-7s: \"%s\"\n", cases[i].loop, joined);
+    if (strcmp(joined, cases[i].expected) != 0)
+      pass = 0;
+    close(fd);
+  }
+
+  if (pass)
+    printf("Test 21 result: PASS\n");
+  else
+    printf("Test 21 result: FAIL\n");
+}
+
+// Test 22: Buffer page flags
+// This test scans a 3 MB buffer (past the 2 MB huge page size) under each SCANNER_PAGES_* combination.
+void test22_buffer_pages() {
+  printf("Test 22: Buffer Page Flags\n");
+  const size_t len = 3 << 20;
+  char *data = malloc(len);
+  static struct scanner_token recs[1024];
+  if (!data)
+    ERR("malloc() failed");
+  for (size_t i = 0; i < len; i++)
+    data[i] = (i % 4096 == 4095) ? '\n' : 'a'; // 768 tokens of 4095 bytes
+  int pass = 1; // flag to track test pass/fail
+
+  for (unsigned int flags = 0; flags <= (SCANNER_PAGES_LOCAL | SCANNER_PAGES_HUGE); flags++) {
+    int fd=open(device_path,O_RDWR); // open device
+    if (fd<0){
+      ERR("open() failed");
+    }
+    if (ioctl(fd,SCANNER_IOC_PAGES,flags)<0)
+      ERR("ioctl() failed to set buffer pages");
+    if (ioctl(fd,SCANNER_IOC_META,1)<0)
+      ERR("ioctl() failed to set metadata mode");
+    if (write(fd,data,len)<0)
+      ERR("write() failed");
+
+    int len_read = read(fd, recs, sizeof(recs));
+    int count = (len_read > 0) ? len_read / (int)sizeof(recs[0]) : 0;
+    int ok = (count == 768);
+    for (int i = 0; i < count; i++)
+      if (recs[i].len != 4095 || recs[i].start != (unsigned long long)i * 4096)
+        ok = 0;
+    printf("  flags %u: %d tokens %s\n", flags, count, ok ? "ok" : "wrong");
+    if (!ok)
+      pass = 0;
+    close(fd);
+  }
+
+  // unknown flags are refused
+  int fd=open(device_path,O_RDWR);
+  if (fd<0){
+    ERR("open() failed");
+  }
+  errno = 0;
+  if (ioctl(fd,SCANNER_IOC_PAGES,4) != -1 || errno != EINVAL)
+    pass = 0;
+  close(fd);
+  free(data);
+
+  if (pass)
+    printf("Test 22 result: PASS\n");
+  else
+    printf("Test 22 result: FAIL\n");
+}
+
+// Test 23: Large writes and reads
+// Transfers over 128 KB reach the CUSE daemon in several pieces: this test checks that a write keeps
+// every piece (plain and batch) and that a token filling whole pieces still ends with a 0 read.
+void test23_large_transfers() {
+  printf("Test 23: Large Writes and Reads\n");
+  const size_t token = 128 << 10; // one full piece
+  const size_t len = 4 * (token + 1);
+  char *data = malloc(len);
+  char *buf = aligned_alloc(4096, 1 << 20); // page-aligned, so the first piece is full too
+  static struct scanner_token recs[256];
+  if (!data || !buf)
+    ERR("malloc() failed");
+  int pass = 1; // flag to track test pass/fail
+
+  // plain: 4 tokens of 128 KB
+  for (size_t i = 0; i < len; i++)
+    data[i] = (i % (token + 1) == token) ? '\n' : 'a' + i / (token + 1);
+  int fd=open(device_path,O_RDWR); // open device
+  if (fd<0){
+    ERR("open() failed");
+  }
+  if (write(fd,data,len) != (ssize_t)len)
+    ERR("write() failed");
+  int tokens = 0;
+  ssize_t n;
+  while ((n = read(fd, buf, 1 << 20)) > 0) {
+    if (n != (ssize_t)token || buf[0] != 'a' + tokens || buf[token - 1] != 'a' + tokens)
+      pass = 0;
+    if (read(fd, buf, 1 << 20) != 0) // end of token
+      pass = 0;
+    tokens++;
+  }
+  printf("  plain: %d tokens of %zu bytes\n", tokens, token);
+  if (tokens != 4)
+    pass = 0;
+  close(fd);
+
+  // batch: 2 documents of 100 tokens of 999 bytes, the first one spanning two pieces
+  const __u32 doc_len = 100 * 1000;
+  size_t off = 0;
+  for (int d = 0; d < 2; d++) {
+    memcpy(data + off, &doc_len, sizeof(doc_len));
+    off += sizeof(doc_len);
+    for (__u32 i = 0; i < doc_len; i++)
+      data[off + i] = (i % 1000 == 999) ? ' ' : 'x';
+    off += doc_len;
+  }
+  fd=open(device_path,O_RDWR);
+  if (fd<0){
+    ERR("open() failed");
+  }
+  if (ioctl(fd,SCANNER_IOC_BATCH,1)<0 || ioctl(fd,SCANNER_IOC_META,1)<0)
+    ERR("ioctl() failed to set batch metadata mode");
+  if (write(fd,data,off) != (ssize_t)off)
+    ERR("write() failed");
+  n = read(fd, recs, sizeof(recs));
+  int count = (n > 0) ? n / (int)sizeof(recs[0]) : 0;
+  for (int i = 0; i < count; i++)
+    if (recs[i].len != 999 || recs[i].doc != (unsigned)(i / 100))
+      pass = 0;
+  printf("  batch: %d tokens\n", count);
+  if (count != 200)
+    pass = 0;
+  close(fd);
+  free(buf);
+  free(data);
+
+  if (pass)
+    printf("Test 23 result: PASS\n");
+  else
+    printf("Test 23 result: FAIL\n");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) // e.g. /dev/scanner-cuse for the user-space daemon
+    device_path = argv[1];
 
-  printf("=== Scanner Device Test ===\n");
+  printf("=== Scanner Device Test (%s) ===\n", device_path);
   test1_default_separators();
   test2_custom_separators();
   test3_non_cumulative_writes();
@@ -635,5 +1350,16 @@ int main() {
   test10_no_separators();
   test11_stress_test(); // for memmory leaks
   test12_invalid_ioctl();
+  test13_metadata_mode();
+  test14_batch_mode();
+  test15_cursor_and_dup();
+  test16_memory_limit();
+  test17_utf8_separators();
+  test18_translation_table();
+  test19_ring();
+  test20_poll();
+  test21_separator_sets();
+  test22_buffer_pages();
+  test23_large_transfers();
   return 0;
 }
@@ -9,9 +9,26 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/moduleparam.h>
+#include <linux/atomic.h>
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/cdev.h>
+#include <linux/kref.h>
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
+#include <linux/topology.h>
+#include <linux/uio.h>
+#include <linux/poll.h>
+
+#include "scanner.h"
+#include "scanner_engine.h"
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("BSU CS 452 HW5");
@@ -23,37 +40,164 @@ typedef struct {
   struct cdev cdev;
   char default_separators[256];
   size_t default_sep_count;
+  atomic_long_t mem_current; // bytes of data currently buffered by all sessions
+  atomic_long_t mem_peak;    // highest value mem_current has reached
 } Device;			/* per-init() data */
 
+// This struct holds written data and its documents.
+// It never changes after write(), so duplicated sessions share it instead of copying.
+typedef struct {
+  struct kref ref;   // one reference per session scanning the buffer
+  size_t charged;    // bytes counted in device.mem_current for this buffer
+  size_t len;        // length of data
+  ScanDoc *docs;         // documents in data (just &whole outside batch mode)
+  size_t doc_count;  // number of documents
+  ScanDoc whole;         // the single document of a plain write
+  char data[];       // data to scan
+} Buffer;
+
+// This struct is a byte ring streaming data from one producer session to one consumer session.
+// head only moves in the producer and tail only in the consumer; each publishes its index
+// with release semantics and reads the other's with acquire semantics, so the fast path
+// takes no locks. Sessions only sleep when the ring is empty or full.
+typedef struct {
+  struct kref ref;    // one reference per linked session
+  char *data;         // ring storage
+  size_t size;        // ring size, a power of two
+  size_t head;        // total bytes written, advanced by the producer
+  size_t tail;        // total bytes consumed, advanced by the consumer
+  int use_mutex;      // SCANNER_RING_MUTEX: indices guarded by lock instead (for comparison)
+  struct mutex lock;  // guards head and tail when use_mutex is set
+  int attached;       // a consumer has linked to the ring
+  int producer_gone;  // the producer has closed: no more data will arrive
+  int consumer_gone;  // the consumer has closed: nobody will read
+  wait_queue_head_t readable; // consumer sleeps here while the ring is empty
+  wait_queue_head_t writable; // producer sleeps here while the ring is full
+} Ring;
 
 typedef struct {
-  char *data;        // data to scan
+  Buffer *buffer;    // written data, possibly shared with duplicated sessions
+  char *data;        // data to scan (buffer->data)
   size_t data_len;   // length of data
   size_t pos;        // current scanning position
   char *separators;  // separator characters
   size_t sep_count;  // number of separator characters
+  ScanSeps seps;      // lookup tables built from separators, and the UTF-8 mode flag
+  unsigned char *xlat; // 256-byte table applied to token bytes on read, NULL= identity
   int config_mode;   // configuration mode flag, 1= next write sets separators
   size_t token_start; // start index of the current token
   size_t token_end;   // end index of the current token
   size_t token_read_pos; // read position within the current token
+  int meta_mode;      // metadata mode flag, 1= read returns scanner_token records
+  int batch_mode;     // batch mode flag, 1= writes carry length-prefixed documents
+  ScanDoc *docs;          // documents in data (buffer->docs)
+  size_t doc_count;   // number of documents
+  size_t doc;         // index of the document being scanned
+  size_t max_bytes;   // largest write() this session accepts, 0= only the module limit
+  Ring *ring;         // ring linking this session to another, NULL if none
+  int ring_producer;  // 1= this session writes into the ring, 0= it reads tokens from it
+  int ring_in_token;  // consumer is partway through returning a token
+  unsigned int pages; // SCANNER_PAGES_* flags for buffers of later writes
 } File;				/* per-open() data */
 
 static Device device;  // create device instance
 
+static unsigned long max_bytes = 64UL << 20;
+module_param(max_bytes, ulong, 0644);
+MODULE_PARM_DESC(max_bytes, "largest write() any session may buffer, in bytes (0 = no limit)");
+
+static unsigned int buffer_pages = SCANNER_PAGES_LOCAL | SCANNER_PAGES_HUGE;
+module_param(buffer_pages, uint, 0644);
+MODULE_PARM_DESC(buffer_pages, "SCANNER_PAGES_* flags new sessions start with (1 = NUMA-local, 2 = huge pages)");
+
+// This function shows a memory counter as a read-only module parameter
+static int get_mem(char *buf, const struct kernel_param *kp) {
+  return sysfs_emit(buf, "%ld\n", atomic_long_read((atomic_long_t *)kp->arg));
+}
+
+static const struct kernel_param_ops mem_ops = {
+  .get = get_mem,
+};
+module_param_cb(mem_current, &mem_ops, &device.mem_current, 0444);
+MODULE_PARM_DESC(mem_current, "bytes of data currently buffered by all sessions");
+module_param_cb(mem_peak, &mem_ops, &device.mem_peak, 0444);
+MODULE_PARM_DESC(mem_peak, "most bytes of data ever buffered at once");
+
+// This function counts bytes of newly buffered data and keeps the peak up to date
+static void mem_charge(size_t bytes) {
+  long now = atomic_long_add_return(bytes, &device.mem_current);
+  long peak = atomic_long_read(&device.mem_peak);
+  while (now > peak) {
+    long old = atomic_long_cmpxchg(&device.mem_peak, peak, now);
+    if (old == peak)
+      break;
+    peak = old;
+  }
+}
+
+// This function stops counting bytes of freed data
+static void mem_uncharge(size_t bytes) {
+  atomic_long_sub(bytes, &device.mem_current);
+}
+
+// This function builds the separator lookup tables for count separator bytes.
+// In UTF-8 mode the bytes are decoded as code points and must be valid UTF-8.
+static int build_separators(File *file, const char *separators, size_t count, gfp_t gfp) {
+  long wide_count = scan_count_wide(file->seps.utf8, separators, count);
+  __u32 *wide = NULL;
+
+  if (wide_count < 0)
+    return wide_count;
+  if (wide_count) {
+    wide = kmalloc_array(wide_count, sizeof(*wide), gfp);
+    if (!wide)
+      return -ENOMEM;
+  }
+  kfree(file->seps.wide);
+  scan_fill_separators(&file->seps, separators, count, wide);
+  return 0;
+}
+
+// This function tells whether a write of count bytes exceeds the module or session limit
+static int over_limit(File *file, size_t count) {
+  unsigned long limit = READ_ONCE(max_bytes);
+  return (limit && count > limit) || (file->max_bytes && count > file->max_bytes);
+}
+
+// This function tells whether a request must fail with -EAGAIN instead of sleeping on a ring:
+// under O_NONBLOCK, or when io_uring tries it inline with IOCB_NOWAIT
+static int is_nonblock(struct kiocb *iocb) {
+  return (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+}
+
+// This function picks allocation flags for a write. Under IOCB_NOWAIT the allocation must not
+// sleep in reclaim; if it fails, the write returns -EAGAIN and io_uring retries it from a worker.
+static gfp_t write_gfp(struct kiocb *iocb) {
+  if (iocb->ki_flags & IOCB_NOWAIT)
+    return GFP_NOWAIT | __GFP_ACCOUNT | __GFP_NOWARN;
+  return GFP_KERNEL_ACCOUNT;
+}
+
+// This function returns the error for an allocation made with write_gfp() that failed
+static int alloc_error(struct kiocb *iocb) {
+  return (iocb->ki_flags & IOCB_NOWAIT) ? -EAGAIN : -ENOMEM;
+}
+
 // This function is called when the file is opened to allocate and initialize per-file data
 static int open(struct inode *inode, struct file *filp) {
-  File *file=(File *)kmalloc(sizeof(*file),GFP_KERNEL);
+  File *file=(File *)kmalloc(sizeof(*file),GFP_KERNEL_ACCOUNT);
   if (!file) {
     printk(KERN_ERR "%s: kmalloc() failed\n",DEVNAME);
     return -ENOMEM;
   }
   // Initialize data
+  file->buffer=NULL;
   file->data=NULL;
   file->data_len=0;
   file->pos=0;
 
   // Copy default separators from device
-  file->separators=kmalloc(device.default_sep_count, GFP_KERNEL);
+  file->separators=kmalloc(device.default_sep_count, GFP_KERNEL_ACCOUNT);
   if (!file->separators) {
     printk(KERN_ERR "%s: kmalloc() failed\n",DEVNAME);
     kfree(file);
@@ -63,79 +207,546 @@ static int open(struct inode *inode, struct file *filp) {
   // Copy default separators from device to file
   memcpy(file->separators, device.default_separators, device.default_sep_count);
   file->sep_count=device.default_sep_count;
+  file->seps.wide=NULL;
+  file->seps.wide_count=0;
+  file->seps.utf8=0;
+  file->xlat=NULL;
+  build_separators(file, file->separators, file->sep_count, GFP_KERNEL_ACCOUNT); // cannot fail in byte mode
   file->config_mode=0;
   file->token_start=0;
   file->token_end=0;
   file->token_read_pos=0;
+  file->meta_mode=0;
+  file->batch_mode=0;
+  file->docs=NULL;
+  file->doc_count=0;
+  file->doc=0;
+  file->max_bytes=0;
+  file->ring=NULL;
+  file->ring_producer=0;
+  file->ring_in_token=0;
+  file->pages=READ_ONCE(buffer_pages) & (SCANNER_PAGES_LOCAL | SCANNER_PAGES_HUGE);
   filp->private_data=file;
+  filp->f_mode |= FMODE_NOWAIT; // reads and writes honor IOCB_NOWAIT (io_uring)
   return 0;
 }
 
+// This function frees a buffer once its last session lets go of it
+static void buffer_release(struct kref *ref) {
+  Buffer *buffer = container_of(ref, Buffer, ref);
+  if (buffer->docs != &buffer->whole)
+    kfree(buffer->docs);
+  mem_uncharge(buffer->charged);
+  kvfree(buffer);
+}
+
+// This function maps size bytes of base pages allocated on node with gfp. It serves local
+// base-page buffers: __vmalloc() takes no node, and vmalloc_node() no gfp flags (no accounting).
+// With VM_MAP_PUT_PAGES, vfree() (and so kvfree()) releases the pages and the page array too.
+static void *buffer_pages_vmap(size_t size, gfp_t gfp, int node) {
+  unsigned int i, count = DIV_ROUND_UP(size, PAGE_SIZE);
+  struct page **pages = kvmalloc_array(count, sizeof(*pages), gfp);
+  void *addr;
+
+  if (!pages)
+    return NULL;
+  for (i = 0; i < count; i++) {
+    pages[i] = alloc_pages_node(node, gfp, 0);
+    if (!pages[i])
+      goto fail;
+    cond_resched();
+  }
+  addr = vmap(pages, count, VM_MAP | VM_MAP_PUT_PAGES, PAGE_KERNEL);
+  if (addr)
+    return addr;
+fail:
+  while (i--)
+    __free_page(pages[i]);
+  kvfree(pages);
+  return NULL;
+}
+
+// This function allocates *size bytes of buffer memory as the SCANNER_PAGES_* flags ask,
+// and updates *size to the bytes actually taken. Every path keeps gfp, so the memory cgroup
+// is charged. Under 2 MB, or without reclaim, it is a plain kvmalloc (kmalloc only without reclaim).
+// Larger sizes come from vmalloc: with SCANNER_PAGES_HUGE through kvmalloc, which maps whole
+// PMD-sized pages when it can (falling back to base pages), and without it from base pages,
+// on the local node with SCANNER_PAGES_LOCAL.
+static void *buffer_pages_alloc(size_t *size, gfp_t gfp, unsigned int flags) {
+  int node = (flags & SCANNER_PAGES_LOCAL) ? numa_node_id() : NUMA_NO_NODE;
+  void *addr;
+
+  if (*size < PMD_SIZE || !gfpflags_allow_blocking(gfp))
+    return kvmalloc_node(*size, gfp, node);
+  if (!(flags & SCANNER_PAGES_HUGE)) {
+    addr = (node == NUMA_NO_NODE) ? __vmalloc(*size, gfp) : buffer_pages_vmap(*size, gfp, node);
+    *size = round_up(*size, PAGE_SIZE);
+    return addr;
+  }
+  // vmalloc rounds a huge mapping up to whole PMD-sized pages itself; the unrounded size of one
+  // write() (at most MAX_RW_COUNT) stays within kvmalloc's INT_MAX limit, where the rounded one may not.
+  // An explicit node also keeps vmalloc from splitting huge pages across nodes.
+  addr = kvmalloc_node(*size, gfp, node);
+  *size = round_up(*size, PMD_SIZE);
+  return addr;
+}
+
+// This function allocates a buffer for len bytes of data
+static Buffer *buffer_alloc(size_t len, gfp_t gfp, unsigned int flags) {
+  size_t size = sizeof(Buffer) + len;
+  Buffer *buffer = buffer_pages_alloc(&size, gfp, flags);
+  if (!buffer)
+    return NULL;
+  kref_init(&buffer->ref);
+  buffer->charged = size - sizeof(*buffer); // data and huge page rounding
+  mem_charge(buffer->charged);
+  buffer->len = len;
+  buffer->whole.start = 0;
+  buffer->whole.end = len;
+  buffer->docs = &buffer->whole;
+  buffer->doc_count = 1;
+  return buffer;
+}
+
+// This function drops the file's reference to its data
+static void free_data(File *file) {
+  if (file->buffer)
+    kref_put(&file->buffer->ref, buffer_release);
+  file->buffer = NULL;
+  file->data = NULL;
+  file->data_len = 0;
+  file->docs = NULL;
+  file->doc_count = 0;
+}
+
+// This function takes the lock of a SCANNER_RING_MUTEX ring for one read() or write().
+// When the caller may not sleep (O_NONBLOCK, IOCB_NOWAIT) it only tries, returning -EAGAIN if busy.
+static int ring_lock(Ring *ring, int nonblock) {
+  if (!ring->use_mutex)
+    return 0;
+  if (nonblock)
+    return mutex_trylock(&ring->lock) ? 0 : -EAGAIN;
+  mutex_lock(&ring->lock);
+  return 0;
+}
+
+// This function releases the lock taken by ring_lock()
+static void ring_unlock(Ring *ring) {
+  if (ring->use_mutex)
+    mutex_unlock(&ring->lock);
+}
+
+// This function reads a ring index published by the other side (under ring_lock())
+static size_t ring_load(Ring *ring, size_t *index) {
+  if (!ring->use_mutex)
+    return smp_load_acquire(index);
+  return READ_ONCE(*index);
+}
+
+// This function publishes a new value of this side's ring index (under ring_lock())
+static void ring_store(Ring *ring, size_t *index, size_t value) {
+  if (!ring->use_mutex) {
+    smp_store_release(index, value);
+    return;
+  }
+  WRITE_ONCE(*index, value);
+}
+
+// This function frees a ring once both sessions have let go of it
+static void ring_release(struct kref *ref) {
+  Ring *ring = container_of(ref, Ring, ref);
+  mem_uncharge(ring->size);
+  kvfree(ring->data);
+  kfree(ring);
+}
+
+// This function unlinks the file from its ring and wakes the other side
+static void ring_detach(File *file) {
+  Ring *ring = file->ring;
+  if (!ring)
+    return;
+  if (file->ring_producer) {
+    smp_store_release(&ring->producer_gone, 1);
+    wake_up_interruptible(&ring->readable);
+  } else {
+    smp_store_release(&ring->consumer_gone, 1);
+    wake_up_interruptible(&ring->writable);
+  }
+  kref_put(&ring->ref, ring_release);
+  file->ring = NULL;
+}
+
+// This function appends count bytes to the ring, sleeping while it is full.
+// Like a pipe, it returns a short count rather than sleeping once some bytes are in.
+// It runs under ring_lock(), dropping the lock only while it sleeps.
+static ssize_t ring_write_locked(File *file, struct iov_iter *from, int nonblock) {
+  Ring *ring = file->ring;
+  size_t mask = ring->size - 1;
+  size_t head = ring->head; // only this producer moves head
+  size_t count = iov_iter_count(from);
+  size_t done = 0;
+
+  while (done < count) {
+    size_t space = ring->size - (head - ring_load(ring, &ring->tail));
+    size_t off = head & mask;
+    size_t len;
+
+    if (smp_load_acquire(&ring->consumer_gone))
+      return done ? done : -EPIPE;
+    if (space == 0) {
+      int err;
+      if (done)
+        break;
+      if (nonblock)
+        return -EAGAIN;
+      // no mutex in the wait condition: it runs with the task already set to sleep
+      ring_unlock(ring);
+      err = wait_event_interruptible(ring->writable,
+        smp_load_acquire(&ring->tail) != head - ring->size || READ_ONCE(ring->consumer_gone));
+      ring_lock(ring, 0); // cannot fail when sleeping is allowed
+      if (err)
+        return err;
+      continue;
+    }
+    len = min3(count - done, space, ring->size - off);
+    if (copy_from_iter(ring->data + off, len, from) != len)
+      return done ? done : -EFAULT;
+    head += len;
+    done += len;
+    ring_store(ring, &ring->head, head);
+    if (wq_has_sleeper(&ring->readable))
+      wake_up_interruptible(&ring->readable);
+  }
+  return done;
+}
+
+// This function appends to the ring under its lock (see ring_write_locked())
+static ssize_t ring_write(File *file, struct iov_iter *from, int nonblock) {
+  ssize_t ret = ring_lock(file->ring, nonblock);
+  if (ret)
+    return ret;
+  ret = ring_write_locked(file, from, nonblock);
+  ring_unlock(file->ring);
+  return ret;
+}
+
 // This function is called when the file is closed to free allocated resources
 static int release(struct inode *inode, struct file *filp) {
   File *file=filp->private_data;
-  if (file->data)
-    kfree(file->data);
+  ring_detach(file);
+  free_data(file);
   if (file->separators)
     kfree(file->separators);
+  kfree(file->seps.wide);
+  kfree(file->xlat);
   kfree(file);
   return 0;
 }
 
+// This function splits batch data into documents, each a __u32 length followed by its bytes
+static int split_documents(Buffer *buffer, gfp_t gfp) {
+  long n = scan_count_documents(buffer->data, buffer->len);
+  ScanDoc *docs;
+
+  if (n < 0)
+    return n;
+  buffer->doc_count = n;
+  if (n == 0)
+    return 0;
+
+  docs = kmalloc_array(n, sizeof(*docs), gfp);
+  if (!docs)
+    return -ENOMEM;
+  buffer->charged += n * sizeof(*docs);
+  mem_charge(n * sizeof(*docs));
+  scan_fill_documents(buffer->data, buffer->len, docs);
+  buffer->docs = docs;
+  return 0;
+}
+
+// This function makes buffer the data the file scans, from the beginning
+static void attach_buffer(File *file, Buffer *buffer) {
+  file->buffer = buffer;
+  file->data = buffer->data;
+  file->data_len = buffer->len;
+  file->docs = buffer->docs;
+  file->doc_count = buffer->doc_count;
+
+  // reset scanning position
+  file->doc = 0;
+  file->pos = file->doc_count ? file->docs[0].start : 0;
+  file->token_start = 0;
+  file->token_end = 0;
+  file->token_read_pos = 0;
+}
+
 // This function handles both writing separators and writing data to be scanned
-static ssize_t write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos) {
-  File *file = filp->private_data;
+// It never sleeps under IOCB_NOWAIT, so io_uring can complete it inline.
+static ssize_t write_iter(struct kiocb *iocb, struct iov_iter *from) {
+  File *file = iocb->ki_filp->private_data;
+  size_t count = iov_iter_count(from);
+  gfp_t gfp = write_gfp(iocb);
+  Buffer *buffer;
+
+  // a ring producer streams into the ring instead of replacing data
+  if (file->ring && file->ring_producer && !file->config_mode)
+    return ring_write(file, from, is_nonblock(iocb));
+
+  // refuse writes larger than the limits before touching old data
+  if (over_limit(file, count))
+    return -ENOSPC;
 
   // Write set separators = MODE 1
   if (file-> config_mode == 1) {
-    // if there is existing separators, free them
-    if (file->separators)
-      kfree(file->separators);
+    char *separators;
+    int err;
 
     // allocate new separators
-    file->separators = kmalloc(count, GFP_KERNEL);
-    if (!file->separators)
-      return -ENOMEM;
+    separators = kmalloc(count, gfp);
+    if (!separators)
+      return alloc_error(iocb);
     // copy new separators from user space
-    if (copy_from_user(file->separators, buf, count))
+    if (copy_from_iter(separators, count, from) != count) {
+      kfree(separators);
       return -EFAULT;
+    }
+    // build lookup tables, rejecting invalid UTF-8 in UTF-8 mode
+    err = build_separators(file, separators, count, gfp);
+    if (err) {
+      kfree(separators);
+      return (err == -ENOMEM) ? alloc_error(iocb) : err;
+    }
 
+    // if there is existing separators, free them
+    if (file->separators)
+      kfree(file->separators);
+    file->separators = separators;
     file->sep_count = count;
     file->config_mode = 0; // reset config mode after setting separators
     return count; 
   }
 
   // Write data to be scanned = MODE 0
-  // free old data if exists
-  if (file->data)
-    kfree(file->data);
   // allocate new data buffer
-  file->data = kmalloc(count, GFP_KERNEL);
-  if (!file->data)
-    return -ENOMEM;
+  buffer = buffer_alloc(count, gfp, file->pages);
+  if (!buffer)
+    return alloc_error(iocb);
   // copy data from user space
-  if (copy_from_user(file->data, buf, count))
+  if (copy_from_iter(buffer->data, count, from) != count) {
+    kref_put(&buffer->ref, buffer_release);
     return -EFAULT;
-  file->data_len = count;
+  }
 
-  // reset scanning position
-  file->pos = 0;
+  // find the documents to scan
+  if (file->batch_mode) {
+    int err = split_documents(buffer, gfp);
+    if (err) {
+      kref_put(&buffer->ref, buffer_release);
+      return (err == -ENOMEM) ? alloc_error(iocb) : err;
+    }
+  }
+  // free old data if exists, only now so a failed write (e.g. -EAGAIN) leaves it in place
+  free_data(file);
+  attach_buffer(file, buffer);
+  return count;
+}
+
+
+// This function finds the next token at or after file->pos, moving on to later documents as needed.
+// On success it sets token_start/token_end, leaves pos at token_end and returns 1.
+static int next_token(File *file) {
+  if (!scan_next_token(&file->seps, file->data, file->docs, file->doc_count,
+                       &file->doc, &file->pos, &file->token_start, &file->token_end))
+    return 0; // no more tokens
+  file->token_read_pos = 0; // reset token read position for new token
+  return 1;
+}
+
+// This function reads token records in metadata mode
+static ssize_t read_meta(File *file, struct iov_iter *to) {
+  struct scanner_token recs[16]; // small batch, copied out together
+  size_t max = iov_iter_count(to) / sizeof(recs[0]);
+  size_t done = 0;
+  size_t n = 0;
+
+  if (max == 0)
+    return -EINVAL; // buffer cannot hold a single record
+
+  // a token partially returned as bytes is skipped
+  if (file->token_start < file->token_end)
+    file->pos = file->token_end;
+
+  while (done + n < max && next_token(file)) {
+    recs[n].start = file->token_start;
+    recs[n].len = file->token_end - file->token_start;
+    recs[n].sep = (file->token_end < file->docs[file->doc].end) ?
+      scan_separator_value(&file->seps, file->data, file->token_end, file->docs[file->doc].end) :
+      SCANNER_SEP_EOF;
+    recs[n].doc = file->doc;
+    n++;
+    // flush a full batch to user space
+    if (n == ARRAY_SIZE(recs)) {
+      if (copy_to_iter(recs, sizeof(recs), to) != sizeof(recs))
+        return -EFAULT;
+      done += n;
+      n = 0;
+    }
+  }
   file->token_start = 0;
   file->token_end = 0;
   file->token_read_pos = 0;
-  return count;
+
+  if (n > 0) {
+    if (copy_to_iter(recs, n * sizeof(recs[0]), to) != n * sizeof(recs[0]))
+      return -EFAULT;
+    done += n;
+  }
+  if (done == 0)
+    return -1; // no more tokens
+  return done * sizeof(recs[0]);
 }
 
+// This function copies n token bytes to user space through the translation table
+static int copy_translated(File *file, struct iov_iter *to, const char *src, size_t n) {
+  unsigned char chunk[128]; // translated bytes waiting to be copied out
+  size_t done, i, len;
 
-// This function reads tokens from the scanned data
-static ssize_t read(struct file *filp,char __user *buf,size_t count,loff_t *f_pos) { 
-  File *file=filp->private_data;
-  size_t i;
-  int is_separator;
+  for (done = 0; done < n; done += len) {
+    len = min_t(size_t, n - done, sizeof(chunk));
+    for (i = 0; i < len; i++)
+      chunk[i] = file->xlat[(unsigned char)src[done + i]];
+    if (copy_to_iter(chunk, len, to) != len)
+      return -EFAULT;
+  }
+  return 0;
+}
+
+// This function copies n token bytes to user space, translating them if a table is set
+static int copy_out(File *file, struct iov_iter *to, const char *src, size_t n) {
+  if (file->xlat)
+    return copy_translated(file, to, src, n);
+  if (copy_to_iter(src, n, to) != n)
+    return -EFAULT;
+  return 0;
+}
+
+// This function returns the next part of the current token, at most count bytes
+static ssize_t read_token_part(File *file, struct iov_iter *to) {
+  const char *part = file->data + file->token_start + file->token_read_pos;
+  size_t remaining = file->token_end - file->token_start - file->token_read_pos;
+  size_t count = iov_iter_count(to);
+  size_t to_send = (remaining < count) ? remaining : count;
+
+  // in UTF-8 mode a partial read never ends inside a code point
+  if (file->seps.utf8 && to_send < remaining) {
+    to_send = scan_utf8_trim(part, to_send, remaining);
+    if (to_send == 0 && count > 0)
+      return -EINVAL; // buffer cannot hold the next code point
+  }
+  // copy token part to user space, mapping bytes on the way if asked to
+  if (copy_out(file, to, part, to_send))
+    return -EFAULT;
+  file->token_read_pos += to_send;
+  return to_send;
+}
+
+// This function publishes consumed ring bytes and wakes a producer waiting for space
+static void ring_consume(Ring *ring, size_t tail) {
+  ring_store(ring, &ring->tail, tail);
+  if (wq_has_sleeper(&ring->writable))
+    wake_up_interruptible(&ring->writable);
+}
+
+// This function reads tokens from the ring as the producer streams them in.
+// It follows the read() protocol: token bytes, 0 at the end of each token, -1 at the end of data.
+// Tokens are split on separator bytes (the byte table); rings refuse the other modes.
+// It runs under ring_lock(), dropping the lock only while it sleeps.
+static ssize_t ring_read_locked(File *file, struct iov_iter *to, int nonblock) {
+  Ring *ring = file->ring;
+  size_t mask = ring->size - 1;
+  size_t tail = ring->tail; // only this consumer moves tail
+  size_t count = iov_iter_count(to);
+  size_t head, n, first;
+  int err;
+
+  for (;;) {
+    head = ring_load(ring, &ring->head);
+    // skip separators before a token
+    while (!file->ring_in_token && tail != head) {
+      if (!file->seps.table[(unsigned char)ring->data[tail & mask]]) {
+        file->ring_in_token = 1;
+        break;
+      }
+      tail++;
+    }
+    if (tail != head)
+      break; // token bytes or the separator ending it are available
+    ring_consume(ring, tail);
+
+    // ring is empty
+    if (smp_load_acquire(&ring->producer_gone)) {
+      if (ring_load(ring, &ring->head) != tail)
+        continue; // last bytes landed just before the producer closed
+      if (file->ring_in_token) {
+        file->ring_in_token = 0;
+        return 0; // end of data ends the token
+      }
+      return -1; // no more tokens
+    }
+    if (nonblock)
+      return -EAGAIN;
+    ring_unlock(ring);
+    err = wait_event_interruptible(ring->readable,
+      smp_load_acquire(&ring->head) != tail || READ_ONCE(ring->producer_gone));
+    ring_lock(ring, 0); // cannot fail when sleeping is allowed
+    if (err)
+      return err;
+  }
+
+  // take token bytes up to the next separator
+  for (n = 0; n < count && tail + n != head; n++)
+    if (file->seps.table[(unsigned char)ring->data[(tail + n) & mask]])
+      break;
+  if (n == 0 && count > 0) {
+    // separator reached: the token is complete
+    file->ring_in_token = 0;
+    ring_consume(ring, tail + 1);
+    return 0;
+  }
+  // copy out, in two pieces if the bytes wrap around the end of the ring
+  first = min(n, ring->size - (tail & mask));
+  if (copy_out(file, to, ring->data + (tail & mask), first) ||
+      copy_out(file, to, ring->data, n - first))
+    return -EFAULT;
+  ring_consume(ring, tail + n);
+  return n;
+}
+
+// This function reads tokens from the ring under its lock (see ring_read_locked())
+static ssize_t ring_read(File *file, struct iov_iter *to, int nonblock) {
+  ssize_t ret = ring_lock(file->ring, nonblock);
+  if (ret)
+    return ret;
+  ret = ring_read_locked(file, to, nonblock);
+  ring_unlock(file->ring);
+  return ret;
+}
+
+// This function reads tokens from the scanned data.
+// Only a ring consumer can sleep, and not under IOCB_NOWAIT, so io_uring can complete it inline.
+static ssize_t read_iter(struct kiocb *iocb, struct iov_iter *to) {
+  File *file=iocb->ki_filp->private_data;
+
+  // a ring consumer scans bytes as they stream in
+  if (file->ring && !file->ring_producer)
+    return ring_read(file, to, is_nonblock(iocb));
 
   // no data to scan
   if (!file->data || file->data_len == 0)
     return -1;
+
+  if (file->meta_mode)
+    return read_meta(file, to);
   
   // Continuing reading from current token if not fully read
   if (file->token_start < file->token_end) {
@@ -143,14 +754,8 @@ static ssize_t read(struct file *filp,char __user *buf,size_t count,loff_t *f_po
     size_t remaining = token_len - file->token_read_pos;
 
     // Still have part of the token to return
-    if (remaining > 0) {
-      size_t to_send = (remaining < count) ? remaining : count;
-      // copy token part to user space
-      if (copy_to_user(buf, file->data + file->token_start + file->token_read_pos, to_send))
-        return -EFAULT;
-      file->token_read_pos += to_send;
-      return to_send;
-    }
+    if (remaining > 0)
+      return read_token_part(file, to);
     // token fully read, reset for next token
     file->pos = file->token_end;
     file->token_start = 0;
@@ -159,57 +764,226 @@ static ssize_t read(struct file *filp,char __user *buf,size_t count,loff_t *f_po
     return 0;
   }
   // Scan for next token
-  while (file->pos < file->data_len) {
-    is_separator = 0;
-    // check if current character is a separator
-    for (i = 0; i < file->sep_count; i++) {
-      if (file->data[file->pos] == file->separators[i]) {// found a separator
-        is_separator = 1;
-        break;
-      }
-    }
-    if (!is_separator)
-      break; // found the start of the next token
-    file->pos++; // skip separator
+  if (!next_token(file))
+    return -1; // no more tokens
+  
+  //return token to user space
+  return read_token_part(file, to);
+}
 
+// This function copies the scan cursor out to user space
+static long get_cursor(File *file, struct scanner_cursor __user *arg) {
+  struct scanner_cursor cursor = {
+    .pos = file->pos,
+    .token_start = file->token_start,
+    .token_end = file->token_end,
+    .token_read_pos = file->token_read_pos,
+    .doc = file->doc,
+  };
+  if (copy_to_user(arg, &cursor, sizeof(cursor)))
+    return -EFAULT;
+  return 0;
+}
+
+// This function moves the scan cursor to a position saved by get_cursor()
+static long set_cursor(File *file, struct scanner_cursor __user *arg) {
+  struct scanner_cursor cursor;
+  size_t start, end;
+
+  if (copy_from_user(&cursor, arg, sizeof(cursor)))
+    return -EFAULT;
+
+  // the cursor must lie in its document, or anywhere once all documents are scanned
+  if (cursor.doc > file->doc_count)
+    return -EINVAL;
+  start = (cursor.doc < file->doc_count) ? file->docs[cursor.doc].start : 0;
+  end = (cursor.doc < file->doc_count) ? file->docs[cursor.doc].end : file->data_len;
+  if (cursor.pos < start || cursor.pos > end)
+    return -EINVAL;
+  // a token being returned must end at pos
+  if (cursor.token_start < cursor.token_end &&
+      (cursor.token_start < start || cursor.token_end != cursor.pos ||
+       cursor.token_read_pos > cursor.token_end - cursor.token_start))
+    return -EINVAL;
+
+  file->doc = cursor.doc;
+  file->pos = cursor.pos;
+  if (cursor.token_start < cursor.token_end) {
+    file->token_start = cursor.token_start;
+    file->token_end = cursor.token_end;
+    file->token_read_pos = cursor.token_read_pos;
+  } else {
+    file->token_start = 0;
+    file->token_end = 0;
+    file->token_read_pos = 0;
   }
-  if (file->pos >= file->data_len)
-    return -1; // no more tokens
+  return 0;
+}
 
-  // find token start
-  file->token_start = file->pos;
+// This function installs the byte translation table at arg, or the identity table if arg is NULL
+static long set_xlat(File *file, const unsigned char __user *arg) {
+  unsigned char *xlat;
+  int i;
 
-  // find token end
-  while (file->pos < file->data_len) {
-    is_separator = 0; // reset separator flag
-    for (i = 0; i < file->sep_count; i++) { // check for separator
-      if (file->data[file->pos] == file->separators[i]) {
-        is_separator = 1;
-        break;
-      }
+  if (!arg) {
+    kfree(file->xlat);
+    file->xlat = NULL;
+    return 0;
+  }
+  xlat = kmalloc(256, GFP_KERNEL_ACCOUNT);
+  if (!xlat)
+    return -ENOMEM;
+  if (copy_from_user(xlat, arg, 256)) {
+    kfree(xlat);
+    return -EFAULT;
+  }
+  // an identity table is dropped so reads keep the plain copy
+  for (i = 0; i < 256 && xlat[i] == i; i++)
+    ;
+  if (i == 256) {
+    kfree(xlat);
+    xlat = NULL;
+  }
+  kfree(file->xlat);
+  file->xlat = xlat;
+  return 0;
+}
+
+static struct file_operations ops;
+
+// This function tells whether the file is in a mode rings do not support:
+// a ring returns token bytes of a plain stream split on separator bytes
+static int ring_unsupported_mode(File *file) {
+  return file->meta_mode || file->batch_mode || file->seps.utf8;
+}
+
+// This function makes the file the producer end of a new ring
+static long ring_create(File *file, struct scanner_ring __user *arg) {
+  struct scanner_ring conf;
+  Ring *ring;
+
+  if (copy_from_user(&conf, arg, sizeof(conf)))
+    return -EFAULT;
+  if (conf.size < 2 || !is_power_of_2(conf.size) || conf.size > INT_MAX || conf.pad != 0 ||
+      (conf.flags & ~SCANNER_RING_MUTEX))
+    return -EINVAL;
+  if (ring_unsupported_mode(file))
+    return -EINVAL;
+  if (over_limit(file, conf.size))
+    return -ENOSPC;
+  if (file->ring)
+    return -EBUSY;
+
+  ring = kzalloc(sizeof(*ring), GFP_KERNEL_ACCOUNT);
+  if (!ring)
+    return -ENOMEM;
+  ring->data = kvmalloc(conf.size, GFP_KERNEL_ACCOUNT);
+  if (!ring->data) {
+    kfree(ring);
+    return -ENOMEM;
+  }
+  mem_charge(conf.size);
+  kref_init(&ring->ref);
+  ring->size = conf.size;
+  ring->use_mutex = !!(conf.flags & SCANNER_RING_MUTEX);
+  mutex_init(&ring->lock);
+  init_waitqueue_head(&ring->readable);
+  init_waitqueue_head(&ring->writable);
+
+  file->ring = ring;
+  file->ring_producer = 1;
+  return 0;
+}
+
+// This function makes the file the consumer end of the ring created on producer_fd
+static long ring_attach(File *file, unsigned int producer_fd) {
+  struct fd f;
+  File *producer;
+  long err = 0;
+
+  if (file->ring)
+    return -EBUSY;
+  if (ring_unsupported_mode(file))
+    return -EINVAL;
+  f = fdget(producer_fd);
+  if (!fd_file(f))
+    return -EBADF;
+  producer = fd_file(f)->private_data;
+  if (fd_file(f)->f_op != &ops || !producer->ring || !producer->ring_producer) {
+    err = -EINVAL; // not the producer end of a ring
+  } else if (cmpxchg(&producer->ring->attached, 0, 1) != 0) {
+    err = -EBUSY; // the ring already has its consumer
+  } else {
+    kref_get(&producer->ring->ref);
+    file->ring = producer->ring;
+    file->ring_producer = 0;
+    file->ring_in_token = 0;
+  }
+  fdput(f);
+  return err;
+}
+
+// This function opens a new session on the same data, cursor and settings.
+// The data is shared, not copied; a later write() on either session replaces only its own.
+static long dup_session(File *file) {
+  File *copy = kmalloc(sizeof(*copy), GFP_KERNEL_ACCOUNT);
+  struct file *anon = NULL;
+  int fd;
+
+  if (!copy)
+    return -ENOMEM;
+  *copy = *file;
+  copy->ring = NULL; // a ring has exactly one producer and one consumer
+  if (file->separators) {
+    copy->separators = kmemdup(file->separators, file->sep_count, GFP_KERNEL_ACCOUNT);
+    if (!copy->separators) {
+      kfree(copy);
+      return -ENOMEM;
     }
-    if (is_separator)
-      break; // end of token found
-    file->pos++;
   }
-  file->token_end = file->pos;
-  file->token_read_pos = 0; // reset token read position for new token
-  
-  //return token to user space
-  {
-    size_t token_len = file->token_end - file->token_start;
-    size_t to_send = (token_len < count) ? token_len : count;
-    if (copy_to_user(buf, file->data + file->token_start, to_send))
-      return -EFAULT;
-    file->token_read_pos += to_send;
-    return to_send;
+  copy->seps.wide = NULL;
+  if (build_separators(copy, copy->separators, copy->sep_count, GFP_KERNEL_ACCOUNT)) {
+    kfree(copy->separators);
+    kfree(copy);
+    return -ENOMEM;
   }
+  if (file->xlat) {
+    copy->xlat = kmemdup(file->xlat, 256, GFP_KERNEL_ACCOUNT);
+    if (!copy->xlat) {
+      kfree(copy->separators);
+      kfree(copy->seps.wide);
+      kfree(copy);
+      return -ENOMEM;
+    }
+  }
+  if (copy->buffer)
+    kref_get(&copy->buffer->ref);
+
+  fd = get_unused_fd_flags(O_CLOEXEC);
+  if (fd >= 0) {
+    anon = anon_inode_getfile(DEVNAME, &ops, copy, O_RDWR);
+    if (IS_ERR(anon)) {
+      put_unused_fd(fd);
+      fd = PTR_ERR(anon);
+    }
+  }
+  if (fd < 0) {
+    free_data(copy);
+    kfree(copy->separators);
+    kfree(copy->seps.wide);
+    kfree(copy->xlat);
+    kfree(copy);
+    return fd;
+  }
+  anon->f_mode |= FMODE_NOWAIT; // like open(), so io_uring can complete requests inline
+  fd_install(fd, anon);
+  return fd;
 }
 
 // This function handles ioctl calls to set configuration mode
 static long ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
    File *file=filp->private_data;
-   // only request 0 is supported
+   // request 0 sets configuration mode, the others are described in scanner.h
    if (cmd==0) { // set configuration mode
      file->config_mode=1; // next write sets separators
      if (file->separators) { // free old separators
@@ -217,19 +991,90 @@ static long ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
        file->separators=NULL; // reset separator pointer
      }
      file->sep_count=0; // reset separator count
+     build_separators(file, NULL, 0, GFP_KERNEL_ACCOUNT); // cannot fail without separators
+     return 0;
+   }
+   if (cmd==SCANNER_IOC_META) { // select token bytes or token records
+     if (arg && file->ring) // rings only return token bytes
+       return -EINVAL;
+     file->meta_mode=(arg!=0);
+     return 0;
+   }
+   if (cmd==SCANNER_IOC_BATCH) { // select length-prefixed documents or plain data
+     if (arg && file->ring) // rings carry a plain stream
+       return -EINVAL;
+     file->batch_mode=(arg!=0);
+     return 0;
+   }
+   if (cmd==SCANNER_IOC_GET_CURSOR) // save scan position
+     return get_cursor(file, (struct scanner_cursor __user *)arg);
+   if (cmd==SCANNER_IOC_SET_CURSOR) // restore scan position
+     return set_cursor(file, (struct scanner_cursor __user *)arg);
+   if (cmd==SCANNER_IOC_DUP) // new fd sharing this data
+     return dup_session(file);
+   if (cmd==SCANNER_IOC_UTF8) { // select UTF-8 or byte separators
+     int old=file->seps.utf8;
+     int err;
+     if (arg && file->ring) // rings split on separator bytes
+       return -EINVAL;
+     file->seps.utf8=(arg!=0);
+     err=build_separators(file, file->separators, file->sep_count, GFP_KERNEL_ACCOUNT);
+     if (err)
+       file->seps.utf8=old; // current separators are not valid UTF-8
+     return err;
+   }
+   if (cmd==SCANNER_IOC_XLAT) // map token bytes on read
+     return set_xlat(file, (const unsigned char __user *)arg);
+   if (cmd==SCANNER_IOC_RING) // become a ring producer
+     return ring_create(file, (struct scanner_ring __user *)arg);
+   if (cmd==SCANNER_IOC_RING_ATTACH) // become a ring consumer
+     return ring_attach(file, arg);
+   if (cmd==SCANNER_IOC_PAGES) { // pick NUMA node and page size for buffers
+     if (arg & ~(unsigned long)(SCANNER_PAGES_LOCAL | SCANNER_PAGES_HUGE))
+       return -EINVAL;
+     file->pages=arg;
+     return 0;
+   }
+   if (cmd==SCANNER_IOC_LIMIT) { // cap write() size for this session
+     file->max_bytes=arg;
      return 0;
    }
    return -ENOTTY; 
     //return -EINVAL; // invalid command
 }
 
+// This function reports which ring operations would sleep, so poll() and io_uring can
+// wait for a ring to become readable or writable instead of parking a thread in read()/write().
+// Sessions without a ring never sleep and are always ready.
+static __poll_t poll(struct file *filp, poll_table *wait) {
+  File *file=filp->private_data;
+  Ring *ring=file->ring;
+
+  if (!ring)
+    return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+  if (file->ring_producer) {
+    poll_wait(filp, &ring->writable, wait);
+    if (smp_load_acquire(&ring->consumer_gone))
+      return EPOLLERR; // writes fail with -EPIPE
+    if (ring->head - smp_load_acquire(&ring->tail) < ring->size)
+      return EPOLLOUT | EPOLLWRNORM;
+    return 0;
+  }
+  poll_wait(filp, &ring->readable, wait);
+  if (smp_load_acquire(&ring->head) != ring->tail || smp_load_acquire(&ring->producer_gone))
+    return EPOLLIN | EPOLLRDNORM;
+  return 0;
+}
+
 // File operations structure
 static struct file_operations ops={
   .open=open,
   .release=release,
-  .read=read,
-  .write=write,
+  .read_iter=read_iter,
+  .write_iter=write_iter,
+  .poll=poll,
   .unlocked_ioctl=ioctl,
+  .compat_ioctl=compat_ptr_ioctl,
   .owner=THIS_MODULE
 };
 
@@ -0,0 +1,95 @@
+/*
+ * File: scanner.h
+ * Description: ioctl requests and record layouts shared by the scanner device and its users.
+ * Author(s): Miguel Carrasco Belmar
+ * Date: 12/09/2025
+ */
+
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define SCANNER_IOC_MAGIC 'S'
+
+// ioctl(fd,0,0): the next write() sets the separators
+#define SCANNER_IOC_CONFIG 0
+// ioctl(fd,SCANNER_IOC_META,1): read() returns struct scanner_token records
+// ioctl(fd,SCANNER_IOC_META,0): read() returns token bytes (default)
+#define SCANNER_IOC_META _IO(SCANNER_IOC_MAGIC,1)
+// ioctl(fd,SCANNER_IOC_BATCH,1): each later write() carries many documents,
+// each a __u32 length in host byte order followed by that many bytes.
+// Tokens never span documents; records report the document index.
+#define SCANNER_IOC_BATCH _IO(SCANNER_IOC_MAGIC,2)
+// ioctl(fd,SCANNER_IOC_GET_CURSOR,&cursor): save the scan position
+// ioctl(fd,SCANNER_IOC_SET_CURSOR,&cursor): restore it; -EINVAL if it does not fit the data
+#define SCANNER_IOC_GET_CURSOR _IOR(SCANNER_IOC_MAGIC,3,struct scanner_cursor)
+#define SCANNER_IOC_SET_CURSOR _IOW(SCANNER_IOC_MAGIC,4,struct scanner_cursor)
+// ioctl(fd,SCANNER_IOC_DUP,0): returns a new fd scanning the same data from
+// the same cursor with the same settings. The data is shared, not copied.
+#define SCANNER_IOC_DUP _IO(SCANNER_IOC_MAGIC,5)
+// ioctl(fd,SCANNER_IOC_LIMIT,bytes): later writes larger than bytes fail
+// with ENOSPC (0 = only the module's max_bytes limit applies)
+#define SCANNER_IOC_LIMIT _IO(SCANNER_IOC_MAGIC,6)
+// ioctl(fd,SCANNER_IOC_UTF8,1): separators and data are UTF-8 text. Each
+// separator is a code point (invalid UTF-8 separators fail with EINVAL),
+// and a partial read() never stops inside a code point; a read() whose
+// buffer cannot hold the next code point fails with EINVAL.
+#define SCANNER_IOC_UTF8 _IO(SCANNER_IOC_MAGIC,7)
+// ioctl(fd,SCANNER_IOC_XLAT,table): token bytes b are returned as table[b]
+// (e.g. for case folding); ioctl(fd,SCANNER_IOC_XLAT,NULL) restores identity.
+// Separators are matched on the original bytes.
+#define SCANNER_IOC_XLAT _IOW(SCANNER_IOC_MAGIC,8,unsigned char[256])
+// ioctl(fd,SCANNER_IOC_RING,&ring): fd becomes the producer end of a new ring
+// of ring.size bytes (a power of two). Its writes then append to the ring,
+// blocking (or failing with EAGAIN under O_NONBLOCK) while the ring is full.
+#define SCANNER_IOC_RING _IOW(SCANNER_IOC_MAGIC,9,struct scanner_ring)
+// ioctl(fd,SCANNER_IOC_RING_ATTACH,producer_fd): fd becomes the consumer end of
+// producer_fd's ring. Its reads return tokens as bytes stream in, blocking while
+// the ring is empty, and -1 once the producer is closed and the ring is drained.
+// Rings return token bytes of a plain stream split on separator bytes: ring
+// sessions refuse SCANNER_IOC_META, SCANNER_IOC_BATCH and SCANNER_IOC_UTF8 (EINVAL),
+// and sessions in those modes cannot create or attach to a ring (EINVAL).
+#define SCANNER_IOC_RING_ATTACH _IO(SCANNER_IOC_MAGIC,10)
+// ioctl(fd,SCANNER_IOC_PAGES,flags): how later writes allocate their buffers, as
+// SCANNER_PAGES_* flags; EINVAL for unknown flags. New sessions start with the
+// module's buffer_pages parameter (both flags unless changed).
+#define SCANNER_IOC_PAGES _IO(SCANNER_IOC_MAGIC,11)
+
+// sep value of a token that ended at the end of the data (or of its document)
+#define SCANNER_SEP_EOF (-1)
+
+// Metadata mode record, one per token
+struct scanner_token {
+  __u64 start; // byte offset of the token in the written data
+  __u64 len;   // length of the token in bytes
+  __s32 sep;   // separator that ended the token (byte, or code point in UTF-8 mode), or SCANNER_SEP_EOF
+  __u32 doc;   // index of the document holding the token, 0 outside batch mode
+};
+
+// Scan cursor, as saved and restored by SCANNER_IOC_GET_CURSOR/SCANNER_IOC_SET_CURSOR
+struct scanner_cursor {
+  __u64 pos;            // scanning position in the written data
+  __u64 token_start;    // start of the token being returned (0 if none)
+  __u64 token_end;      // end of the token being returned (0 if none)
+  __u64 token_read_pos; // bytes of that token already returned
+  __u64 doc;            // index of the document being scanned
+};
+
+// Ring settings for SCANNER_IOC_RING
+struct scanner_ring {
+  __u64 size;  // ring size in bytes, a power of two up to 1 GB
+  __u32 flags; // SCANNER_RING_* flags
+  __u32 pad;   // reserved, must be 0 (EINVAL otherwise)
+};
+
+// guard ring indices with a mutex instead of lock-free acquire/release (for benchmarking)
+#define SCANNER_RING_MUTEX 1
+
+// allocate buffers on the NUMA node of the CPU running write(), not by the task's memory policy
+#define SCANNER_PAGES_LOCAL 1
+// round buffers of 2 MB or more up to whole huge pages and map them with huge pages when possible
+#define SCANNER_PAGES_HUGE 2
+
+#endif
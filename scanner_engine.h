@@ -0,0 +1,352 @@
+/*
+ * File: scanner_engine.h
+ * Description: Scan engine shared by the scanner kernel module and the CUSE daemon.
+ *              It only looks at memory it is given, so it builds in the kernel and in user space.
+ * Author(s): Miguel Carrasco Belmar
+ * Date: 12/09/2025
+ */
+
+#ifndef SCANNER_ENGINE_H
+#define SCANNER_ENGINE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#else
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/types.h>
+#endif
+
+#define SCAN_UTF8_INVALID 0xFFFFFFFFu  // code point reported for a byte that starts no valid sequence
+
+// This struct describes one document inside the written data
+typedef struct {
+  size_t start;      // index of the first byte of the document
+  size_t end;        // index one past the last byte of the document
+} ScanDoc;
+
+typedef struct ScanSeps ScanSeps;
+
+// A token finder skips separators from *pos, then sets *start to the token there and *pos
+// just past it, returning 1; it returns 0 with *pos = end if only separators are left
+typedef int (*ScanFind)(const ScanSeps *seps, const char *data, size_t *pos, size_t end, size_t *start);
+
+// This struct holds a separator set in the form the scan loops use
+struct ScanSeps {
+  unsigned char table[256]; // 1 for each separator byte (only ASCII ones in UTF-8 mode)
+  __u32 *wide;        // non-ASCII separator code points in UTF-8 mode
+  size_t wide_count;  // number of non-ASCII separator code points
+  int utf8;           // UTF-8 mode flag, 1= separators and data are UTF-8 text
+  unsigned char single; // the separator when there is exactly one
+  ScanFind find;      // token finder specialized for this separator set
+};
+
+// This function decodes the UTF-8 sequence at s (avail bytes available).
+// It returns the sequence length, or 1 with *cp = SCAN_UTF8_INVALID for a malformed byte.
+static inline size_t scan_utf8_decode(const unsigned char *s, size_t avail, __u32 *cp) {
+  unsigned char c = s[0];
+  unsigned char lo = 0x80, hi = 0xBF; // allowed range of the second byte
+  size_t n, i;
+  __u32 value;
+
+  if (c < 0x80) {
+    *cp = c;
+    return 1;
+  }
+  if (c >= 0xC2 && c <= 0xDF) {
+    n = 2;
+    value = c & 0x1F;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    n = 3;
+    value = c & 0x0F;
+    if (c == 0xE0)
+      lo = 0xA0; // overlong
+    if (c == 0xED)
+      hi = 0x9F; // surrogates
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    n = 4;
+    value = c & 0x07;
+    if (c == 0xF0)
+      lo = 0x90; // overlong
+    if (c == 0xF4)
+      hi = 0x8F; // above U+10FFFF
+  } else {
+    *cp = SCAN_UTF8_INVALID;
+    return 1;
+  }
+  if (avail < n || s[1] < lo || s[1] > hi) {
+    *cp = SCAN_UTF8_INVALID;
+    return 1;
+  }
+  for (i = 1; i < n; i++) {
+    if ((s[i] & 0xC0) != 0x80) {
+      *cp = SCAN_UTF8_INVALID;
+      return 1;
+    }
+    value = (value << 6) | (s[i] & 0x3F);
+  }
+  *cp = value;
+  return n;
+}
+
+// This function checks count separator bytes for the given mode.
+// It returns how many non-ASCII code points they hold, or -EINVAL for invalid UTF-8.
+static inline long scan_count_wide(int utf8, const char *separators, size_t count) {
+  const unsigned char *s = (const unsigned char *)separators;
+  long wide_count = 0;
+  size_t i, n;
+  __u32 cp;
+
+  if (!utf8)
+    return 0;
+  for (i = 0; i < count; i += n) {
+    n = scan_utf8_decode(s + i, count - i, &cp);
+    if (cp == SCAN_UTF8_INVALID)
+      return -EINVAL;
+    if (n > 1)
+      wide_count++;
+  }
+  return wide_count;
+}
+
+static inline ScanFind scan_select_find(ScanSeps *seps);
+
+// This function fills seps from separators already checked by scan_count_wide().
+// wide must have room for the code points it counted; seps->utf8 selects the mode.
+static inline void scan_fill_separators(ScanSeps *seps, const char *separators, size_t count, __u32 *wide) {
+  const unsigned char *s = (const unsigned char *)separators;
+  size_t i, n;
+
+  memset(seps->table, 0, sizeof(seps->table));
+  seps->wide = wide;
+  seps->wide_count = 0;
+  for (i = 0; i < count; i += n) {
+    n = 1;
+    if (seps->utf8 && s[i] >= 0x80) {
+      n = scan_utf8_decode(s + i, count - i, &wide[seps->wide_count++]);
+      continue;
+    }
+    seps->table[s[i]] = 1;
+  }
+  seps->find = scan_select_find(seps);
+}
+
+// This function tells whether cp is one of the non-ASCII separators
+static inline int scan_is_wide(const ScanSeps *seps, __u32 cp) {
+  size_t k;
+  for (k = 0; k < seps->wide_count; k++)
+    if (cp == seps->wide[k])
+      return 1;
+  return 0;
+}
+
+// This function returns the length of the separator at data[i], or 0 if a token starts there.
+// Like scan_token_end(), it is only used in UTF-8 mode.
+static inline size_t scan_separator_at(const ScanSeps *seps, const char *data, size_t i, size_t end) {
+  unsigned char c = data[i];
+  size_t n;
+  __u32 cp;
+
+  if (!(c & 0x80))
+    return seps->table[c];
+  n = scan_utf8_decode((const unsigned char *)data + i, end - i, &cp);
+  return scan_is_wide(seps, cp) ? n : 0;
+}
+
+#define SCAN_HIGH_BITS (~0UL / 0xFF * 0x80) // 0x8080...80: the high bit of every byte of a word
+
+// This function returns the index just past the token starting at data[i], in UTF-8 mode.
+// ASCII bytes only need a table lookup: a word of bytes is tested for high bits once, then
+// byte by byte against the table. A high-bit byte is decoded as a whole code point.
+static inline size_t scan_token_end(const ScanSeps *seps, const char *text, size_t i, size_t end) {
+  const unsigned char *data = (const unsigned char *)text;
+
+  while (i < end) {
+    unsigned long word;
+    size_t n;
+    __u32 cp;
+
+    // ASCII run: one high-bit test per word, no decoding
+    while (end - i >= sizeof(word)) {
+      memcpy(&word, data + i, sizeof(word));
+      if (word & SCAN_HIGH_BITS)
+        break;
+      for (n = 0; n < sizeof(word); n++)
+        if (seps->table[data[i + n]])
+          return i + n;
+      i += sizeof(word);
+    }
+    while (i < end && !(data[i] & 0x80)) {
+      if (seps->table[data[i]])
+        return i;
+      i++;
+    }
+    if (i >= end)
+      break;
+    // high-bit byte: decode the whole code point
+    n = scan_utf8_decode(data + i, end - i, &cp);
+    if (scan_is_wide(seps, cp))
+      return i;
+    i += n;
+  }
+  return end;
+}
+
+// This function finds a token with the UTF-8 decoding loops, for sets with non-ASCII separators
+static inline int scan_find_utf8(const ScanSeps *seps, const char *data, size_t *pos, size_t end, size_t *start) {
+  // skip separators
+  while (*pos < end) {
+    size_t n = scan_separator_at(seps, data, *pos, end);
+    if (!n)
+      break;
+    *pos += n;
+  }
+  if (*pos >= end)
+    return 0;
+  // find token start and end
+  *start = *pos;
+  *pos = scan_token_end(seps, data, *pos, end);
+  return 1;
+}
+
+// Byte-level token finders, one per common separator set. They are also exact in UTF-8 mode
+// when every separator is ASCII, since no byte of a multi-byte sequence is ASCII.
+// SCAN_DEFINE_FIND(name, IS_SEP, TOKEN_END) defines scan_find_<name>() from a test for one
+// separator byte and an expression giving the first separator at or after i (or end).
+#define SCAN_DEFINE_FIND(name, IS_SEP, TOKEN_END) \
+static inline int scan_find_##name(const ScanSeps *seps, const char *text, size_t *pos, size_t end, size_t *start) { \
+  const unsigned char *data = (const unsigned char *)text; \
+  size_t i = *pos; \
+  (void)seps; \
+  while (i < end && IS_SEP(seps, data[i])) \
+    i++; \
+  if (i >= end) { \
+    *pos = end; \
+    return 0; \
+  } \
+  *start = i; \
+  *pos = TOKEN_END; \
+  return 1; \
+}
+
+// TOKEN_END for finders without a faster search: test bytes one by one after the token start
+#define SCAN_LOOP_END(IS_SEP) ({ \
+  size_t j = i + 1; \
+  while (j < end && !IS_SEP(seps, data[j])) \
+    j++; \
+  j; \
+})
+
+#define SCAN_SEP_NONE(seps, c) ((void)(c), 0)
+#define SCAN_SEP_SINGLE(seps, c) ((c) == (seps)->single)
+#define SCAN_SEP_TABLE(seps, c) ((seps)->table[c])
+
+static inline size_t scan_memchr_end(const ScanSeps *seps, const unsigned char *data, size_t i, size_t end) {
+  const unsigned char *sep = memchr(data + i, seps->single, end - i);
+  return sep ? (size_t)(sep - data) : end;
+}
+
+SCAN_DEFINE_FIND(none, SCAN_SEP_NONE, end)                             // no separators: one token
+SCAN_DEFINE_FIND(single, SCAN_SEP_SINGLE, scan_memchr_end(seps, data, i + 1, end)) // one separator
+SCAN_DEFINE_FIND(table, SCAN_SEP_TABLE, SCAN_LOOP_END(SCAN_SEP_TABLE)) // any other byte set
+
+// This function picks the token finder for the separator set in seps
+static inline ScanFind scan_select_find(ScanSeps *seps) {
+  size_t count = 0;
+  int c;
+
+  if (seps->wide_count)
+    return scan_find_utf8;
+  for (c = 0; c < 256; c++) {
+    if (!seps->table[c])
+      continue;
+    count++;
+    seps->single = c;
+  }
+  if (count == 0)
+    return scan_find_none;
+  if (count == 1)
+    return scan_find_single;
+  return scan_find_table;
+}
+
+// This function returns the separator at data[i] as reported in token records:
+// the byte, or the code point in UTF-8 mode
+static inline __s32 scan_separator_value(const ScanSeps *seps, const char *data, size_t i, size_t end) {
+  __u32 cp;
+  if (!seps->utf8)
+    return (unsigned char)data[i];
+  scan_utf8_decode((const unsigned char *)data + i, end - i, &cp);
+  return cp;
+}
+
+// This function shortens a chunk of n token bytes at s, with avail token bytes left,
+// so that it does not stop inside a UTF-8 sequence
+static inline size_t scan_utf8_trim(const char *s, size_t n, size_t avail) {
+  size_t back;
+  __u32 cp;
+
+  for (back = 1; back <= 3 && back <= n; back++) {
+    if (((unsigned char)s[n - back] & 0xC0) != 0x80) {
+      // s[n-back] starts a sequence: cut before it if it runs past the chunk
+      if (scan_utf8_decode((const unsigned char *)s + n - back, avail - (n - back), &cp) > back)
+        return n - back;
+      return n;
+    }
+  }
+  return n; // stray continuation bytes, nothing to keep together
+}
+
+// This function finds the next token at or after *pos in document *doc, moving on to later
+// documents as needed. On success it sets *start/*end, leaves *pos at *end and returns 1.
+static inline int scan_next_token(const ScanSeps *seps, const char *data, const ScanDoc *docs, size_t doc_count,
+                                  size_t *doc, size_t *pos, size_t *start, size_t *end) {
+  while (*doc < doc_count) {
+    if (seps->find(seps, data, pos, docs[*doc].end, start)) {
+      *end = *pos;
+      return 1;
+    }
+    // document exhausted, continue with the next one
+    if (++*doc < doc_count)
+      *pos = docs[*doc].start;
+  }
+  return 0; // no more tokens
+}
+
+// This function checks batch data, each document a __u32 length followed by its bytes.
+// It returns the number of documents, or -EINVAL if the data is malformed.
+static inline long scan_count_documents(const char *data, size_t len) {
+  size_t off;
+  long n = 0;
+  __u32 doc_len;
+
+  for (off = 0; off < len; off += doc_len) {
+    if (len - off < sizeof(doc_len))
+      return -EINVAL; // truncated length prefix
+    memcpy(&doc_len, data + off, sizeof(doc_len));
+    off += sizeof(doc_len);
+    if (doc_len > len - off)
+      return -EINVAL; // document runs past the end of the data
+    n++;
+  }
+  return n;
+}
+
+// This function records where each document of batch data checked by scan_count_documents() lives
+static inline void scan_fill_documents(const char *data, size_t len, ScanDoc *docs) {
+  size_t off, n = 0;
+  __u32 doc_len;
+
+  for (off = 0; off < len; off += doc_len) {
+    memcpy(&doc_len, data + off, sizeof(doc_len));
+    off += sizeof(doc_len);
+    docs[n].start = off;
+    docs[n].end = off + doc_len;
+    n++;
+  }
+}
+
+#endif